@@ -2,7 +2,18 @@
 // Created by meox on 28/12/17.
 //
 
+#ifndef PARSER_KPML_HPP_H
+#define PARSER_KPML_HPP_H
+
 #include "lparser.hpp"
+#include "lparser_bricks.hpp"
+#include "lparser_choice.hpp"
+#include "lparser_memo.hpp"
+#include "lparser_numeric.hpp"
+#include "lparser_parallel.hpp"
+#include "lparser_profile.hpp"
+#include "lparser_stream.hpp"
+#include "lparser_structure.hpp"
 #include <boost/variant.hpp>
 
 
@@ -21,6 +32,11 @@ namespace kpml
             _out << "{ \"type\": \"number\", \"value\": " << v << " }";
         }
 
+        void operator()(const double& v) const
+        {
+            _out << "{ \"type\": \"number\", \"value\": " << v << " }";
+        }
+
         void operator()(const std::string& v) const
         {
             _out << "{ \"type\": \"string\", \"value\": \"" << v << "\" }";
@@ -34,25 +50,58 @@ namespace kpml
         std::ostream& _out;
     };
 
+    /*
+     * a node of a kpml tree. Copy and destruction recurse over the first
+     * native_depth levels only, and go on below with an explicit stack, as
+     * render() does: a tree of any depth is safe to handle, and a shallow one
+     * costs no more than it would otherwise.
+     */
     struct statement_t
     {
+        static constexpr std::size_t native_depth = 64;
+
         statement_t() = default;
-        statement_t(const statement_t& rhs)
+
+        statement_t(std::string s)
+        {
+            set_raw(std::move(s));
+        }
+
+        statement_t(symbol_t s)
+        {
+            set_raw(std::move(s));
+        }
+
+        statement_t(const statement_t& o)
+        : op(o.op), raw_data(o.raw_data), leaf(o.leaf)
+        {
+            copy_operands(*this, o, 0);
+        }
+
+        statement_t(statement_t&&) = default;
+
+        statement_t& operator=(const statement_t& o)
         {
-            op = rhs.op;
-            operands = rhs.operands;
-            raw_data = rhs.raw_data;
-            leaf = rhs.leaf;
+            if (this != &o)
+                *this = statement_t{o};
+            return *this;
         }
 
-        statement_t(const std::string& s)
+        // o may be a node of this tree: it is taken out before the old tree goes
+        statement_t& operator=(statement_t&& o) noexcept
         {
-            set_raw(s);
+            statement_t taken{std::move(o)};
+            std::swap(op, taken.op);
+            std::swap(operands, taken.operands);
+            std::swap(raw_data, taken.raw_data);
+            std::swap(leaf, taken.leaf);
+            return *this;
         }
 
-        statement_t(const symbol_t& s)
+        ~statement_t()
         {
-            set_raw(s);
+            if (!operands.empty())
+                release(operands, 0);
         }
 
         std::string op{"?"};
@@ -62,7 +111,7 @@ namespace kpml
         void set_raw(T d)
         {
             leaf = true;
-            raw_data = d;
+            raw_data = std::move(d);
         }
 
         void show_leaf(std::ostream& out) const
@@ -71,306 +120,460 @@ namespace kpml
         }
 
         bool is_leaf() const { return leaf; }
+
+        // the value of a leaf holding a T, or nullptr
+        template <typename T>
+        const T* leaf_if() const { return leaf ? boost::get<T>(&raw_data) : nullptr; }
     private:
-        boost::variant<symbol_t, uint64_t, std::string> raw_data;
+        static void copy_operands(statement_t& to, const statement_t& from, std::size_t depth)
+        {
+            to.operands.reserve(from.operands.size());
+            for (const auto& x : from.operands)
+            {
+                to.operands.push_back(shallow(x));
+                if (x.operands.empty())
+                    continue;
+                if (depth < native_depth)
+                    copy_operands(to.operands.back(), x, depth + 1);
+                else
+                    copy_deep(to.operands.back(), x);
+            }
+        }
+
+        static void copy_deep(statement_t& root, const statement_t& source)
+        {
+            // each pending pair is a node copied without its operands, and its source
+            std::vector<std::pair<statement_t*, const statement_t*>> pending{{&root, &source}};
+            while (!pending.empty())
+            {
+                const auto [to, from] = pending.back();
+                pending.pop_back();
+
+                to->operands.reserve(from->operands.size());
+                for (const auto& x : from->operands)
+                {
+                    to->operands.push_back(shallow(x));
+                    if (!x.operands.empty())
+                        pending.emplace_back(&to->operands.back(), &x);
+                }
+            }
+        }
+
+        // empties xs; each node is destroyed once its own operands are gone
+        static void release(std::vector<statement_t>& xs, std::size_t depth)
+        {
+            for (auto& x : xs)
+            {
+                if (x.operands.empty())
+                    continue;
+                if (depth < native_depth)
+                    release(x.operands, depth + 1);
+                else
+                    release_deep(x.operands);
+            }
+            xs.clear();
+        }
+
+        static void release_deep(std::vector<statement_t>& xs)
+        {
+            std::vector<statement_t> pending{std::move(xs)};
+            while (!pending.empty())
+            {
+                statement_t s{std::move(pending.back())};
+                pending.pop_back();
+                for (auto& x : s.operands)
+                    pending.push_back(std::move(x));
+                s.operands.clear();
+            }
+        }
+
+        static statement_t shallow(const statement_t& o)
+        {
+            statement_t s;
+            s.op = o.op;
+            s.raw_data = o.raw_data;
+            s.leaf = o.leaf;
+            return s;
+        }
+
+        boost::variant<symbol_t, uint64_t, double, std::string> raw_data;
         bool leaf{false};
     };
 
 
-    parser_t<statement_t> expr(std::string inp);
-    parser_t<statement_t> function_call(std::string inp);
+    // s as JSON: leaves by type and value, other nodes by op and operands
+    inline void render(std::ostream& out, const statement_t& s)
+    {
+        struct frame_t
+        {
+            const statement_t* node;
+            std::size_t next;   // the operand to write next
+        };
+
+        std::vector<frame_t> pending{{&s, 0}};
+        while (!pending.empty())
+        {
+            auto& f = pending.back();
+            const auto& node = *f.node;
+            if (f.next == 0)
+            {
+                if (node.is_leaf())
+                {
+                    node.show_leaf(out);
+                    pending.pop_back();
+                    continue;
+                }
+
+                out << R"({ "op": ")" << node.op << "\",";
+                if (node.operands.empty())
+                {
+                    out << "}";
+                    pending.pop_back();
+                    continue;
+                }
+                out << " \"operands\": [";
+            }
+            else if (f.next == node.operands.size())
+            {
+                out << "]}";
+                pending.pop_back();
+                continue;
+            }
+            else
+            {
+                out << ", ";
+            }
+
+            const auto* x = &node.operands[f.next++];
+            pending.push_back(frame_t{x, 0});
+        }
+    }
 
 
-    inline parser_t<statement_t> factor(std::string inp)
+    /* binary operators of expr: the lower level binds looser, all associate to the left */
+    inline const std::vector<operator_def_t>& operators()
     {
-        statement_t a{};
-        const auto r = parse(
-                seq(
-                    space,
-                    pipe(
-                        parser_bind(
-                                seq(
-                                    char_eq('('),
-                                    space,
-                                    parser_bind(expr, [&](const statement_t& s) {
-                                        a = s;
-                                        return pure(1);
-                                    }),
-                                    space,
-                                    char_eq(')')
-                                ), [](auto) { return pure(1); }
-                        ),
-                        parser_bind(function_call, [&](const statement_t& s) {
-                            a = s;
-                            return pure(1);
-                        }),
-                        parser_bind(ident, [&](const std::string& s) {
-                            a.set_raw(symbol_t{s});
-                            return pure(1);
-                        }),
-                        parser_bind(nat, [&](long s) {
-                            a.set_raw(s);
-                            return pure(1);
-                        }),
-                        parser_bind(string, [&](const std::string& s) {
-                            a.set_raw(s);
-                            return pure(1);
-                        })
-                    ),
-                    space
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(a, r.remain);
+        static const std::vector<operator_def_t> table{
+                {"+", 1, assoc_t::left}, {"-", 1, assoc_t::left},
+                {">", 1, assoc_t::left}, {"<", 1, assoc_t::left},
+                {">=", 1, assoc_t::left}, {"<=", 1, assoc_t::left},
+                {"==", 1, assoc_t::left},
+                {"*", 2, assoc_t::left}, {"/", 2, assoc_t::left},
+                {"in", 2, assoc_t::left}, {"!", 2, assoc_t::left},
+                {"&&", 2, assoc_t::left}, {"||", 2, assoc_t::left}
+        };
+        return table;
     }
 
 
-    inline parser_t<statement_t> term(std::string inp)
+    /*
+     * builds statement_t trees: the node constructors the grammar is written against.
+     * Another builder (see kpml_ast.hpp) can produce a different AST from the same rules.
+     */
+    struct tree_builder_t
     {
-        statement_t v;
-
-        const auto r = parse(
-                seq(
-                    space,
-                    pipe(
-                        parser_bind(
-                            seq(
-                                parser_bind(factor, [&](const statement_t& s) {
-                                    v.operands.push_back(s);
-                                    return pure(1);
-                                }),
-                                space,
-                                parser_bind(pipe(
-                                        string_eq("*"), string_eq("/"),
-                                        string_eq("in"), string_eq("!"),
-                                        string_eq("&&"), string_eq("||")
-                                ), [&](const std::string& op) {
-                                    v.op = op;
-                                    return pure(1);
-                                }),
-                                space,
-                                parser_bind(term, [&](const statement_t& s) {
-                                    v.operands.push_back(s);
-                                    return pure(1);
-                                })
-                            ), [](auto x) { return pure(1); }),
-                        parser_bind(factor, [&](const statement_t& s) {
-                            v = s;
-                            return pure(1);
-                        })
-                    ),
-                    space
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(v, r.remain);
-    }
+        using node_t = statement_t;
+
+        static node_t symbol(std::string_view name) { return statement_t{symbol_t{std::string{name}}}; }
+        static node_t string(std::string_view s) { return statement_t{std::string{s}}; }
+
+        template <typename T>
+        static node_t number(T v)
+        {
+            statement_t a;
+            a.set_raw(v);
+            return a;
+        }
+
+        // op indexes operators()
+        static node_t binary(std::size_t op, node_t lhs, node_t rhs)
+        {
+            statement_t v;
+            v.op = operators()[op].token;
+            v.operands.reserve(2);
+            v.operands.push_back(std::move(lhs));
+            v.operands.push_back(std::move(rhs));
+            return v;
+        }
+
+        static node_t apply(std::string_view name, std::vector<node_t> args)
+        {
+            statement_t stm;
+            stm.op = "apply";
+            stm.operands.reserve(args.size() + 1);
+            stm.operands.push_back(symbol_t{std::string{name}});
+            for (auto& a : args)
+                stm.operands.push_back(std::move(a));
+            return stm;
+        }
+
+        static node_t if_else(node_t cond, node_t then, node_t otherwise)
+        {
+            statement_t stm;
+            stm.op = "if";
+            stm.operands.reserve(3);
+            stm.operands.push_back(std::move(cond));
+            stm.operands.push_back(std::move(then));
+            stm.operands.push_back(std::move(otherwise));
+            return stm;
+        }
+
+        static node_t begin(std::vector<node_t> statements)
+        {
+            statement_t stm;
+            stm.op = "begin";
+            stm.operands = std::move(statements);
+            return stm;
+        }
 
+        static node_t def(std::string_view name, const std::vector<std::string_view>& params, node_t body)
+        {
+            statement_t parameters;
+            parameters.op = "parameters";
+            parameters.operands.reserve(params.size());
+            for (const auto& x : params)
+                parameters.operands.push_back(symbol_t{std::string{x}});
+
+            statement_t stm;
+            stm.op = "def";
+            stm.operands.reserve(3);
+            stm.operands.push_back(std::string{name});
+            stm.operands.push_back(std::move(parameters));
+            stm.operands.push_back(std::move(body));
+            return stm;
+        }
+    };
 
-    inline parser_t<statement_t> expr(std::string inp)
+
+    /*
+     * expr, factor and function_call re-parse the same prefix when an
+     * alternative fails; they are memoized while a memo_scope of their node type
+     * is alive on the calling thread (packrat mode), and run plainly otherwise.
+     * A statement_t tree cannot be replayed without copying it, so this table
+     * only remembers failures: the linear-time packrat parse is the arena
+     * grammar's, whose arena::packrat_t replays node ids.
+     */
+    using packrat_t = memo_table_t<statement_t>;
+    using packrat_scope = memo_scope<statement_t>;
+
+    enum class rule_id : std::size_t { expr, factor, function_call };
+
+    /* numeric literals: 0x/0o/0b integers, '_' between digits, a float needs a point or an exponent */
+    inline constexpr number_format_t number_format{true, '_', true, false};
+
+
+    /*
+     * the grammar, over a node builder B.
+     * Every rule is a static combinator object built once on first use:
+     * results are assembled from the seq tuples, nothing is captured by reference.
+     */
+    namespace grammar
     {
-        statement_t v;
-
-        const auto r = parse(
-                seq(
-                    space,
-                    pipe(
-                        parser_bind(
-                            seq(
-                                parser_bind(term, [&](const statement_t& s) {
-                                    v.operands.push_back(s);
-                                    return pure(1);
-                                }),
-                                space,
-                                parser_bind(pipe(
-                                        string_eq("+"), string_eq("-"),
-                                        string_eq(">"), string_eq("<"),
-                                        string_eq(">="), string_eq("<="),
-                                        string_eq("==")
-                                ), [&](const std::string& op) {
-                                    v.op = op;
-                                    return pure(1);
-                                }),
-                                space,
-                                parser_bind(expr, [&](const statement_t& s) {
-                                    v.operands.push_back(s);
-                                    return pure(1);
-                                })
-                            ), [](auto) { return pure(1); }),
-                        parser_bind(term, [&](const statement_t& s) {
-                            v = s;
-                            return pure(1);
-                        })
+        template <typename B> using result_t = parser_t<typename B::node_t>;
+
+        template <typename B> inline result_t<B> expr(input_t inp);
+        template <typename B> inline result_t<B> function_call(input_t inp);
+        template <typename B> inline result_t<B> statement(input_t inp);
+
+
+        // the parser of factor_rule, an object whose FIRST set choice() can read
+        template <typename B>
+        inline const auto& factor_parser()
+        {
+            static const auto p = token(choice(
+                    fmap(
+                        seq(char_eq('('), space, expr<B>, space, char_eq(')')),
+                        [](auto x) { return std::get<2>(std::move(x)); }
                     ),
-                    space
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(v, r.remain);
-    }
+                    starts_with(classes::space | classes::lower, function_call<B>),
+                    starts_with(classes::lower, fmap(ident, [](std::string_view s) { return B::symbol(s); })),
+                    fmap(floating<double>(number_format), [](double v) { return B::number(v); }),
+                    fmap(integral<std::uint64_t>(number_format), [](std::uint64_t v) { return B::number(v); }),
+                    starts_with(classes::space | char_class_t::of("\""), fmap(string, [](std::string_view s) { return B::string(s); }))
+            ));
+
+            return p;
+        }
 
+        template <typename B>
+        inline result_t<B> factor_rule(input_t inp)
+        {
+            return parse(factor_parser<B>(), inp);
+        }
 
-    inline parser_t<statement_t> function_call(std::string inp)
-    {
-        statement_t stm;
-
-        auto r = parse(
-                seq(
-                    space,
-                    parser_bind(ident, [&stm](const std::string& function_name){
-                        stm.op = "apply";
-                        stm.operands.push_back(symbol_t{function_name});
-                        return pure(1);
-                    }),
-                    space,
-                    char_eq('('),
-                    space,
-                    parser_bind(params(expr), [&](const std::vector<statement_t> xs) {
-                        for (const auto& x : xs)
-                            stm.operands.push_back(x);
-                        return pure(1);
-                    }),
-                    space,
-                    char_eq(')'),
-                    space
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(stm, r.remain);
-    }
+        template <typename B>
+        inline result_t<B> factor(input_t inp)
+        {
+            static const auto p = named("factor", nested(memo(std::size_t(rule_id::factor), factor_rule<B>)));
+            return parse(p, inp);
+        }
 
-    inline parser_t<statement_t> statement(std::string inp);
 
-    inline parser_t<statement_t> if_else(std::string inp)
-    {
-        statement_t stm;
-        stm.op = "if";
-
-        auto r = parse(
-                seq(
-                    symbol("if"),
-                    symbol("("),
-                    parser_bind(expr, [&](const statement_t& s){
-                        stm.operands.push_back(s);
-                        return pure(1);
-                    }),
-                    symbol(")"),
-                    symbol("{"),
-                    parser_bind(statement, [&](const statement_t& s){
-                        stm.operands.push_back(s);
-                        return pure(1);
-                    }),
-                    symbol("}"),
-                    symbol("else"),
-                    symbol("{"),
-                    parser_bind(statement, [&](const statement_t& s) {
-                        stm.operands.push_back(s);
-                        return pure(1);
-                    }),
-                    symbol("}")
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(stm, r.remain);
-    }
+        template <typename B>
+        inline result_t<B> expr_rule(input_t inp)
+        {
+            static const auto p = expression(factor<B>, operators(), B::binary);
+            return parse(p, inp);
+        }
 
+        template <typename B>
+        inline result_t<B> expr(input_t inp)
+        {
+            static const auto p = named("expr", memo(std::size_t(rule_id::expr), expr_rule<B>));
+            return parse(p, inp);
+        }
 
-    inline parser_t<statement_t> statement(std::string inp)
-    {
-        auto r = parse(
-                seq(space, pipe(if_else, expr), space),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(std::get<1>(r.get()), r.remain);
-    }
 
+        template <typename B>
+        inline result_t<B> function_call_rule(input_t inp)
+        {
+            static const auto p = fmap(
+                    seq(
+                        space,
+                        ident,
+                        space,
+                        char_eq('('),
+                        space,
+                        params(expr<B>),
+                        space,
+                        char_eq(')'),
+                        space
+                    ),
+                    [](auto x) {
+                        return B::apply(std::get<1>(x), std::get<5>(std::move(x)));
+                    }
+            );
 
-    inline parser_t<statement_t> function_body(std::string inp)
-    {
-        statement_t stm;
-
-        auto r = parse(
-                seq(
-                    parser_bind(statement, [&](const statement_t& s){
-                        stm.op = "begin";
-                        stm.operands.push_back(s);
-                        return pure(1);
-                    }),
-                    parser_bind(many(seq(symbol(";"), statement)), [&](const auto& xs) {
-                        for(const auto& x: xs)
-                            stm.operands.push_back(std::get<1>(x));
-                        return pure(1);
-                    })
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(stm, r.remain);
+            return parse(p, inp);
+        }
+
+        template <typename B>
+        inline result_t<B> function_call(input_t inp)
+        {
+            static const auto p = named("function_call", memo(std::size_t(rule_id::function_call), function_call_rule<B>));
+            return parse(p, inp);
+        }
+
+
+        template <typename B>
+        inline const auto& if_else_parser()
+        {
+            static const auto p = named("if_else", fmap(
+                    seq(
+                        token(keyword("if")),
+                        cut,
+                        symbol("("),
+                        expr<B>,
+                        symbol(")"),
+                        symbol("{"),
+                        statement<B>,
+                        symbol("}"),
+                        token(keyword("else")),
+                        symbol("{"),
+                        statement<B>,
+                        symbol("}")
+                    ),
+                    [](auto x) {
+                        return B::if_else(
+                                std::get<2>(std::move(x)),
+                                std::get<5>(std::move(x)),
+                                std::get<9>(std::move(x))
+                        );
+                    }
+            ));
+
+            return p;
+        }
+
+        template <typename B>
+        inline result_t<B> if_else(input_t inp)
+        {
+            return parse(if_else_parser<B>(), inp);
+        }
+
+
+        template <typename B>
+        inline result_t<B> statement(input_t inp)
+        {
+            // the rules are functions choice() cannot look into: each declares where its parser starts
+            static const auto p = named("statement", nested(fmap(
+                    seq(
+                        space,
+                        choice(
+                            starts_with(first_of(if_else_parser<B>()).chars, if_else<B>),
+                            starts_with(first_of(factor_parser<B>()).chars, expr<B>)
+                        ),
+                        space
+                    ),
+                    [](auto x) { return std::get<1>(std::move(x)); }
+            )));
+
+            return parse(p, inp);
+        }
+
+
+        template <typename B>
+        inline result_t<B> function_body(input_t inp)
+        {
+            static const auto p = named("function_body", fmap(
+                    sep_by1(statement<B>, symbol(";")),
+                    [](std::vector<typename B::node_t> statements) { return B::begin(std::move(statements)); }
+            ));
+
+            return parse(p, inp);
+        }
+
+
+        template <typename B>
+        inline result_t<B> function_def(input_t inp)
+        {
+            static const auto p = named("function_def", fmap(
+                    seq(
+                        token(keyword("def")),
+                        cut,
+                        ident,
+                        symbol("("),
+                        params(ident),
+                        symbol(")"),
+                        symbol("{"),
+                        function_body<B>,
+                        symbol("}")
+                    ),
+                    [](auto x) {
+                        return B::def(std::get<1>(x), std::get<3>(x), std::get<6>(std::move(x)));
+                    }
+            ));
+
+            return parse(p, inp);
+        }
     }
 
 
-    inline parser_t<statement_t> function_def(std::string inp)
+    /* the statement_t grammar */
+
+    inline parser_t<statement_t> factor(input_t inp) { return grammar::factor<tree_builder_t>(inp); }
+    inline parser_t<statement_t> expr(input_t inp) { return grammar::expr<tree_builder_t>(inp); }
+    inline parser_t<statement_t> function_call(input_t inp) { return grammar::function_call<tree_builder_t>(inp); }
+    inline parser_t<statement_t> if_else(input_t inp) { return grammar::if_else<tree_builder_t>(inp); }
+    inline parser_t<statement_t> statement(input_t inp) { return grammar::statement<tree_builder_t>(inp); }
+    inline parser_t<statement_t> function_body(input_t inp) { return grammar::function_body<tree_builder_t>(inp); }
+    inline parser_t<statement_t> function_def(input_t inp) { return grammar::function_def<tree_builder_t>(inp); }
+
+    // the statements of a function body, separated by ';', parsed as they arrive in chunks
+    inline decltype(auto) statement_stream() { return push_parser(statement); }
+
+    // a top-level def ends with the '}' closing its body
+    inline constexpr delimiters_t definition_delimiters{';', '}'};
+
+    // every top-level def of text, each parsed by a thread of pool, in source order
+    inline std::vector<parser_t<statement_t>> parse_definitions(std::string_view text, work_pool_t& pool)
     {
-        statement_t stm;
-
-        auto r = parse(
-                seq(
-                    symbol("def"),
-                    parser_bind(ident, [&stm](const std::string& function_name){
-                        stm.op = "def";
-                        stm.operands.push_back(function_name);
-                        return pure(1);
-                    }),
-                    symbol("("),
-                    parser_bind(params(ident), [&](const std::vector<std::string>& xs) {
-                        statement_t parameters;
-                        parameters.op = "parameters";
-                        for (const auto& x : xs)
-                            parameters.operands.push_back(symbol_t{x});
-                        stm.operands.push_back(parameters);
-                        return pure(1);
-                    }),
-                    symbol(")"),
-                    symbol("{"),
-                    parser_bind(function_body, [&](const statement_t& s){
-                        stm.operands.push_back(s);
-                        return pure(1);
-                    }),
-                    symbol("}")
-                ),
-                inp
-        );
-
-        if (r.is_empty())
-            return empty<statement_t>(r.remain);
-        else
-            return parser_t<statement_t>(stm, r.remain);
+        // past the reach of the index's 32-bit offsets the scalar scanner splits it
+        const auto segments = text.size() <= structural_index_t::max_text
+                ? split(structural_index_t{text, definition_delimiters})
+                : split(text, definition_delimiters);
+        return parse_segments(function_def, text, segments, pool);
     }
 }
+
+#endif //PARSER_KPML_HPP_H
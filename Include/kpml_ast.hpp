@@ -0,0 +1,421 @@
+//
+// Arena-backed compact AST for kpml
+//
+
+#ifndef PARSER_KPML_AST_HPP_H
+#define PARSER_KPML_AST_HPP_H
+
+#include "kpml.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+
+namespace kpml
+{
+    enum class opcode_t : std::uint8_t
+    {
+        // leaves
+        symbol, string, number, real,
+        // binary operators, in the order of operators()
+        add, sub, gt, lt, ge, le, eq, mul, div, in, bang, and_, or_,
+        // forms
+        apply, if_, begin, def, parameters,
+        unknown
+    };
+
+    inline std::string_view opcode_name(opcode_t op)
+    {
+        static constexpr std::string_view names[] = {
+                "symbol", "string", "number", "real",
+                "+", "-", ">", "<", ">=", "<=", "==", "*", "/", "in", "!", "&&", "||",
+                "apply", "if", "begin", "def", "parameters",
+                "?"
+        };
+        return names[static_cast<std::size_t>(op)];
+    }
+
+    inline opcode_t opcode_of(std::string_view op)
+    {
+        for (auto i = static_cast<std::size_t>(opcode_t::add); i < static_cast<std::size_t>(opcode_t::unknown); i++)
+        {
+            if (opcode_name(static_cast<opcode_t>(i)) == op)
+                return static_cast<opcode_t>(i);
+        }
+        return opcode_t::unknown;
+    }
+
+
+    /* string interning: equal names get the same id, the text lives in stable blocks */
+
+    class interner_t
+    {
+    public:
+        using atom_t = std::uint32_t;
+
+        atom_t intern(std::string_view s)
+        {
+            const auto it = ids.find(s);
+            if (it != ids.end())
+                return it->second;
+
+            const auto stored = lent(s) ? s : store(s);
+            const auto id = static_cast<atom_t>(names.size());
+            names.push_back(stored);
+            ids.emplace(stored, id);
+            return id;
+        }
+
+        std::string_view name(atom_t id) const { return names[id]; }
+        std::size_t size() const { return names.size(); }
+
+        void clear()
+        {
+            ids.clear();
+            names.clear();
+            blocks.clear();
+            cursor = nullptr;
+            left = 0;
+            borrowed = false;
+        }
+
+        /*
+         * names found inside source are kept as views into it instead of copies
+         * (a mapped file, say). Call borrow() again, with the next source or an
+         * empty one, before source goes away: the names lent by it are copied
+         * into the blocks then, under the same ids, so every atom handed out
+         * (and every node holding one) stays valid.
+         */
+        void borrow(std::string_view s)
+        {
+            if (borrowed)
+                adopt();
+            source = s;
+        }
+
+    private:
+        static constexpr std::size_t block_size = 16 * 1024;
+
+        bool inside(std::string_view s) const
+        {
+            return !source.empty()
+                    && std::less_equal<const char*>{}(source.data(), s.data())
+                    && std::less_equal<const char*>{}(s.data() + s.size(), source.data() + source.size());
+        }
+
+        bool lent(std::string_view s)
+        {
+            const auto in = inside(s);
+            borrowed = borrowed || in;
+            return in;
+        }
+
+        // the names viewing into source replaced by copies of their own
+        void adopt()
+        {
+            for (std::size_t id = 0; id < names.size(); ++id)
+            {
+                if (!inside(names[id]))
+                    continue;
+
+                const auto copy = store(names[id]);
+                ids.erase(names[id]);
+                ids.emplace(copy, static_cast<atom_t>(id));
+                names[id] = copy;
+            }
+            borrowed = false;
+        }
+
+        std::string_view store(std::string_view s)
+        {
+            if (s.empty())
+                return {};
+
+            // long names get a block of their own, the current one keeps filling up
+            if (s.size() > block_size / 4)
+            {
+                blocks.push_back(std::make_unique<char[]>(s.size()));
+                std::memcpy(blocks.back().get(), s.data(), s.size());
+                return {blocks.back().get(), s.size()};
+            }
+
+            if (left < s.size())
+            {
+                blocks.push_back(std::make_unique<char[]>(block_size));
+                cursor = blocks.back().get();
+                left = block_size;
+            }
+
+            char* out = cursor;
+            std::memcpy(out, s.data(), s.size());
+            cursor += s.size();
+            left -= s.size();
+            return {out, s.size()};
+        }
+
+        std::unordered_map<std::string_view, atom_t> ids;
+        std::vector<std::string_view> names;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* cursor{nullptr};
+        std::size_t left{};
+        std::string_view source;
+        bool borrowed{false};
+    };
+
+
+    /*
+     * all nodes of a set of trees in one vector, children as index ranges into a
+     * second one. Nodes are trivially destructible: clear() frees every tree in O(1)
+     * and keeps the capacity (and the interned atoms) for the next parse.
+     */
+    class ast_t
+    {
+    public:
+        using node_id = std::uint32_t;
+        using atom_t = interner_t::atom_t;
+
+        struct range_t { std::uint32_t first, count; };
+
+        struct node_t
+        {
+            opcode_t op;
+            union
+            {
+                range_t children;
+                std::uint64_t number;
+                double real;
+                atom_t atom;
+            };
+        };
+
+        node_id leaf(opcode_t op, std::string_view text)
+        {
+            node_t n{};
+            n.op = op;
+            n.atom = atoms.intern(text);
+            return push(n);
+        }
+
+        node_id number(std::uint64_t v)
+        {
+            node_t n{};
+            n.op = opcode_t::number;
+            n.number = v;
+            return push(n);
+        }
+
+        node_id real(double v)
+        {
+            node_t n{};
+            n.op = opcode_t::real;
+            n.real = v;
+            return push(n);
+        }
+
+        node_id make(opcode_t op, const node_id* children, std::size_t count)
+        {
+            node_t n{};
+            n.op = op;
+            n.children.first = static_cast<std::uint32_t>(edges.size());
+            n.children.count = static_cast<std::uint32_t>(count);
+            edges.insert(edges.end(), children, children + count);
+            return push(n);
+        }
+
+        const node_t& operator[](node_id id) const { return nodes[id]; }
+
+        bool is_leaf(node_id id) const { return nodes[id].op <= opcode_t::real; }
+
+        std::size_t arity(node_id id) const
+        {
+            return is_leaf(id) ? 0 : nodes[id].children.count;
+        }
+
+        node_id child(node_id id, std::size_t i) const
+        {
+            return edges[nodes[id].children.first + i];
+        }
+
+        std::string_view text(node_id id) const { return atoms.name(nodes[id].atom); }
+
+        std::size_t size() const { return nodes.size(); }
+        interner_t& interner() { return atoms; }
+
+        // leaves refer into source instead of copying their text, see interner_t::borrow
+        void borrow(std::string_view source) { atoms.borrow(source); }
+
+        void clear()
+        {
+            nodes.clear();
+            edges.clear();
+        }
+
+        // the same JSON as render() for the equivalent statement_t, with an explicit stack
+        void show(std::ostream& out, node_id root) const
+        {
+            std::vector<std::pair<node_id, std::uint32_t>> pending{{root, 0}};   // a node, the child to write next
+            while (!pending.empty())
+            {
+                auto& [id, next] = pending.back();
+                const auto& n = nodes[id];
+                if (next == 0)
+                {
+                    switch (n.op)
+                    {
+                        case opcode_t::number:
+                            out << R"({ "type": "number", "value": )" << n.number << " }";
+                            pending.pop_back();
+                            continue;
+                        case opcode_t::real:
+                            out << R"({ "type": "number", "value": )" << n.real << " }";
+                            pending.pop_back();
+                            continue;
+                        case opcode_t::string:
+                            out << R"({ "type": "string", "value": ")" << text(id) << "\" }";
+                            pending.pop_back();
+                            continue;
+                        case opcode_t::symbol:
+                            out << R"({ "type": "symbol", "value": ")" << text(id) << "\" }";
+                            pending.pop_back();
+                            continue;
+                        default:
+                            break;
+                    }
+
+                    out << R"({ "op": ")" << opcode_name(n.op) << "\",";
+                    if (n.children.count == 0)
+                    {
+                        out << "}";
+                        pending.pop_back();
+                        continue;
+                    }
+                    out << " \"operands\": [";
+                }
+                else if (next == n.children.count)
+                {
+                    out << "]}";
+                    pending.pop_back();
+                    continue;
+                }
+                else
+                {
+                    out << ", ";
+                }
+
+                const auto x = child(id, next++);
+                pending.emplace_back(x, 0);
+            }
+        }
+
+        // the ast filled by the kpml::arena rules in the current context
+        static ast_t* active() { return parse_context_t::current().get<ast_t>(); }
+
+    private:
+        node_id push(const node_t& n)
+        {
+            nodes.push_back(n);
+            return static_cast<node_id>(nodes.size() - 1);
+        }
+
+        std::vector<node_t> nodes;
+        std::vector<node_id> edges;
+        interner_t atoms;
+    };
+
+
+    // routes the kpml::arena rules of the current context to an ast for its lifetime
+    struct ast_scope
+    {
+        explicit ast_scope(ast_t& ast)
+        : context(parse_context_t::current()), previous(context.set(&ast))
+        {}
+
+        ~ast_scope() { context.set(previous); }
+
+        ast_scope(const ast_scope&) = delete;
+        ast_scope& operator=(const ast_scope&) = delete;
+
+    private:
+        parse_context_t& context;
+        ast_t* previous;
+    };
+
+
+    // builds into the active ast; nodes of failed alternatives stay until clear()
+    struct arena_builder_t
+    {
+        using node_t = ast_t::node_id;
+
+        static ast_t& ast()
+        {
+            // an arena rule run outside an ast_scope: a programming error, not a parse failure
+            const auto a = ast_t::active();
+            if (a == nullptr)
+            {
+                std::fputs("kpml::arena: rule run without an ast_scope\n", stderr);
+                std::abort();
+            }
+            return *a;
+        }
+
+        static node_t symbol(std::string_view name) { return ast().leaf(opcode_t::symbol, name); }
+        static node_t string(std::string_view s) { return ast().leaf(opcode_t::string, s); }
+        static node_t number(std::uint64_t v) { return ast().number(v); }
+        static node_t number(double v) { return ast().real(v); }
+
+        // op indexes operators(), in the order of the opcodes
+        static node_t binary(std::size_t op, node_t lhs, node_t rhs)
+        {
+            const node_t xs[] = {lhs, rhs};
+            return ast().make(static_cast<opcode_t>(static_cast<std::size_t>(opcode_t::add) + op), xs, 2);
+        }
+
+        static node_t apply(std::string_view name, std::vector<node_t> args)
+        {
+            args.insert(args.begin(), symbol(name));
+            return ast().make(opcode_t::apply, args.data(), args.size());
+        }
+
+        static node_t if_else(node_t cond, node_t then, node_t otherwise)
+        {
+            const node_t xs[] = {cond, then, otherwise};
+            return ast().make(opcode_t::if_, xs, 3);
+        }
+
+        static node_t begin(std::vector<node_t> statements)
+        {
+            return ast().make(opcode_t::begin, statements.data(), statements.size());
+        }
+
+        static node_t def(std::string_view name, const std::vector<std::string_view>& params, node_t body)
+        {
+            std::vector<node_t> ps;
+            ps.reserve(params.size());
+            for (const auto& x : params)
+                ps.push_back(symbol(x));
+
+            const node_t xs[] = {string(name), ast().make(opcode_t::parameters, ps.data(), ps.size()), body};
+            return ast().make(opcode_t::def, xs, 3);
+        }
+    };
+
+
+    /* the kpml grammar building into the ast of the enclosing ast_scope */
+    namespace arena
+    {
+        using node_id = ast_t::node_id;
+        using packrat_t = memo_table_t<node_id>;
+        using packrat_scope = memo_scope<node_id>;
+
+        inline parser_t<node_id> expr(input_t inp) { return grammar::expr<arena_builder_t>(inp); }
+        inline parser_t<node_id> statement(input_t inp) { return grammar::statement<arena_builder_t>(inp); }
+        inline parser_t<node_id> function_body(input_t inp) { return grammar::function_body<arena_builder_t>(inp); }
+        inline parser_t<node_id> function_def(input_t inp) { return grammar::function_def<arena_builder_t>(inp); }
+    }
+}
+
+#endif //PARSER_KPML_AST_HPP_H
@@ -0,0 +1,228 @@
+//
+// Constant folding and simplification of statement_t trees
+//
+
+#ifndef PARSER_KPML_FOLD_HPP_H
+#define PARSER_KPML_FOLD_HPP_H
+
+#include "kpml.hpp"
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+
+namespace kpml
+{
+    /*
+     * the value rules the folder relies on, shared with whoever evaluates the trees:
+     * integers stay integers and mix with reals as reals; comparisons, && and ||
+     * give the integers 1 and 0, and a number is true when it is not 0.
+     * Integer arithmetic that would overflow or go below 0, and any division by 0,
+     * is not folded: it is left to run time to decide.
+     */
+    namespace folding
+    {
+        struct number_t
+        {
+            bool real;
+            std::uint64_t u;
+            double d;
+
+            double as_real() const { return real ? d : static_cast<double>(u); }
+            bool truth() const { return real ? d != 0.0 : u != 0; }
+        };
+
+        inline std::optional<number_t> number_of(const statement_t& s)
+        {
+            if (const auto u = s.leaf_if<std::uint64_t>())
+                return number_t{false, *u, 0.0};
+            if (const auto d = s.leaf_if<double>())
+                return number_t{true, 0, *d};
+            return std::nullopt;
+        }
+
+        template <typename T>
+        inline statement_t leaf(T v)
+        {
+            statement_t s;
+            s.set_raw(v);
+            return s;
+        }
+
+        inline statement_t truth(bool b) { return leaf(std::uint64_t{b ? 1u : 0u}); }
+
+        // an overflowed real has no literal to render as: it stays an operation
+        inline std::optional<statement_t> finite(double v)
+        {
+            return std::isfinite(v) ? std::optional<statement_t>{leaf(v)} : std::nullopt;
+        }
+
+        // op applied to two numbers, when it has a value known now
+        inline std::optional<statement_t> binary(const std::string& op, const number_t& a, const number_t& b)
+        {
+            if (op == "&&")
+                return truth(a.truth() && b.truth());
+            if (op == "||")
+                return truth(a.truth() || b.truth());
+
+            if (!a.real && !b.real)
+            {
+                const auto x = a.u, y = b.u;
+                std::uint64_t r;
+                if (op == "+")
+                    return __builtin_add_overflow(x, y, &r) ? std::nullopt : std::optional<statement_t>{leaf(r)};
+                if (op == "-")
+                    return x < y ? std::nullopt : std::optional<statement_t>{leaf(x - y)};
+                if (op == "*")
+                    return __builtin_mul_overflow(x, y, &r) ? std::nullopt : std::optional<statement_t>{leaf(r)};
+                if (op == "/")
+                    return y == 0 ? std::nullopt : std::optional<statement_t>{leaf(x / y)};
+                if (op == ">") return truth(x > y);
+                if (op == "<") return truth(x < y);
+                if (op == ">=") return truth(x >= y);
+                if (op == "<=") return truth(x <= y);
+                if (op == "==") return truth(x == y);
+                return std::nullopt;
+            }
+
+            const auto x = a.as_real(), y = b.as_real();
+            if (op == "+") return finite(x + y);
+            if (op == "-") return finite(x - y);
+            if (op == "*") return finite(x * y);
+            if (op == "/")
+                return y == 0.0 ? std::nullopt : finite(x / y);
+            if (op == ">") return truth(x > y);
+            if (op == "<") return truth(x < y);
+            if (op == ">=") return truth(x >= y);
+            if (op == "<=") return truth(x <= y);
+            if (op == "==") return truth(x == y);
+            return std::nullopt;
+        }
+
+        // s replaced by one of its operands, without copying the operand's subtree
+        inline void replace_by_operand(statement_t& s, std::size_t i)
+        {
+            statement_t kept = std::move(s.operands[i]);
+            s = std::move(kept);
+        }
+
+        inline bool is_operator(const std::string& op)
+        {
+            for (const auto& o : operators())
+            {
+                if (o.token == op)
+                    return true;
+            }
+            return false;
+        }
+
+        // the operands of nested begins moved up into s, in order; false when there are none
+        inline bool splice_begins(statement_t& s)
+        {
+            std::size_t n{};
+            bool nested{false};
+            for (const auto& x : s.operands)
+            {
+                const bool b = !x.is_leaf() && x.op == "begin";
+                nested = nested || b;
+                n += b ? x.operands.size() : 1;
+            }
+            if (!nested)
+                return false;
+
+            std::vector<statement_t> flat;
+            flat.reserve(n);
+            for (auto& x : s.operands)
+            {
+                if (!x.is_leaf() && x.op == "begin")
+                {
+                    for (auto& y : x.operands)
+                        flat.push_back(std::move(y));
+                }
+                else
+                {
+                    flat.push_back(std::move(x));
+                }
+            }
+            s.operands = std::move(flat);
+            return true;
+        }
+
+        // s, whose operands are simplified already, folded or spliced; whether it was rewritten
+        inline bool rewrite(statement_t& s)
+        {
+            if (s.operands.size() == 2 && is_operator(s.op))
+            {
+                const auto a = number_of(s.operands[0]);
+                const auto b = a ? number_of(s.operands[1]) : std::nullopt;
+                if (b)
+                {
+                    if (auto r = binary(s.op, *a, *b))
+                    {
+                        s = std::move(*r);
+                        return true;
+                    }
+                }
+            }
+            else if (s.op == "if" && s.operands.size() == 3)
+            {
+                if (const auto c = number_of(s.operands[0]))
+                {
+                    replace_by_operand(s, c->truth() ? 1 : 2);
+                    return true;
+                }
+            }
+            else if (s.op == "begin")
+            {
+                return splice_begins(s);
+            }
+            return false;
+        }
+    }
+
+
+    /*
+     * folds constant arithmetic and comparisons, reduces an if with a constant
+     * condition to the branch it takes and splices nested begins into their
+     * parent, bottom-up in one traversal. Nodes are rewritten in place: a
+     * folded node becomes a leaf, a decided if becomes its branch, and only a
+     * begin that absorbs others gets a new operand vector.
+     * The traversal keeps its own stack, like render(): a flat sum of many
+     * terms parses to a tree as deep as it is long.
+     * Returns the number of nodes rewritten.
+     */
+    inline std::size_t simplify(statement_t& s)
+    {
+        struct frame_t
+        {
+            statement_t* node;
+            std::size_t next;   // the operand to visit next
+        };
+
+        if (s.is_leaf())
+            return 0;
+
+        std::size_t n{};
+        std::vector<frame_t> pending{{&s, 0}};
+        while (!pending.empty())
+        {
+            auto& f = pending.back();
+            if (f.next < f.node->operands.size())
+            {
+                // operands only move when their parent is rewritten, after all of them
+                auto* x = &f.node->operands[f.next++];
+                if (!x->is_leaf())
+                    pending.push_back(frame_t{x, 0});
+                continue;
+            }
+
+            auto* node = f.node;
+            pending.pop_back();
+            n += folding::rewrite(*node);
+        }
+        return n;
+    }
+}
+
+#endif //PARSER_KPML_FOLD_HPP_H
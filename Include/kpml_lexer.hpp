@@ -0,0 +1,391 @@
+//
+// kpml tokenized in one pass, and the kpml grammar over the tokens
+//
+
+#ifndef PARSER_KPML_LEXER_HPP_H
+#define PARSER_KPML_LEXER_HPP_H
+
+#include "kpml.hpp"
+#include "lparser_token.hpp"
+#include <optional>
+
+
+namespace kpml
+{
+    /*
+     * token kinds. Punctuation and one-character operators are their own
+     * character; the other kinds are control bytes, never identifier
+     * characters, so the operator table of the token grammar needs no word rule.
+     */
+    namespace kind
+    {
+        inline constexpr char identifier = '\x01';
+        inline constexpr char integer = '\x02';
+        inline constexpr char real = '\x03';
+        inline constexpr char string = '\x04';
+        inline constexpr char kw_if = '\x05';
+        inline constexpr char kw_else = '\x06';
+        inline constexpr char kw_def = '\x07';
+        inline constexpr char op_in = '\x08';
+        inline constexpr char op_ge = '\x10';
+        inline constexpr char op_le = '\x11';
+        inline constexpr char op_eq = '\x12';
+        inline constexpr char op_and = '\x13';
+        inline constexpr char op_or = '\x14';
+        inline constexpr char invalid = '\x7f';   // a byte no token starts with
+    }
+
+    namespace lexing
+    {
+        struct spelled_t
+        {
+            std::string spelling;
+            char kind;
+        };
+
+        // reserved words: the lexer never hands them out as identifiers
+        inline const std::vector<spelled_t>& words()
+        {
+            static const std::vector<spelled_t> table{
+                    {"if", kind::kw_if}, {"else", kind::kw_else}, {"def", kind::kw_def}, {"in", kind::op_in}
+            };
+            return table;
+        }
+
+        inline const std::vector<spelled_t>& punctuation()
+        {
+            static const std::vector<spelled_t> table{
+                    {"(", '('}, {")", ')'}, {"{", '{'}, {"}", '}'}, {",", ','}, {";", ';'},
+                    {"+", '+'}, {"-", '-'}, {"*", '*'}, {"/", '/'}, {"!", '!'},
+                    {">", '>'}, {"<", '<'}, {">=", kind::op_ge}, {"<=", kind::op_le},
+                    {"==", kind::op_eq}, {"&&", kind::op_and}, {"||", kind::op_or}
+            };
+            return table;
+        }
+
+        inline const literal_trie_t& punctuation_trie()
+        {
+            static const literal_trie_t trie{[] {
+                std::vector<std::string> spellings;
+                for (const auto& p : punctuation())
+                    spellings.push_back(p.spelling);
+                return spellings;
+            }()};
+            return trie;
+        }
+
+        inline char word_kind(std::string_view w)
+        {
+            for (const auto& k : words())
+            {
+                if (k.spelling == w)
+                    return k.kind;
+            }
+            return kind::identifier;
+        }
+
+        inline char kind_of(std::string_view spelling)
+        {
+            for (const auto& p : punctuation())
+            {
+                if (p.spelling == spelling)
+                    return p.kind;
+            }
+            return word_kind(spelling);
+        }
+    }
+
+
+    /*
+     * the tokens of text, blanks skipped, with identifiers and strings interned
+     * and numbers converted. Literals are recognized by the parsers the text
+     * grammar uses, so both read the same language, except that the words
+     * above are reserved. A byte that starts no token becomes an invalid token
+     * the grammar stops at, and so does a text over token_stream_t::max_text.
+     */
+    inline void lex(std::string_view text, token_stream_t& out)
+    {
+        static constexpr char_scanner_t blank{classes::space};
+        static constexpr char_scanner_t word{classes::ident_tail};
+        static constexpr char_scanner_t content{classes::alnum};
+        static constexpr auto real = floating<double>(number_format);
+        static constexpr auto integer = integral<std::uint64_t>(number_format);
+
+        out.reset(text);
+        if (text.size() > token_stream_t::max_text)
+        {
+            // too long for 32-bit offsets: one invalid token the grammar stops at
+            out.push(kind::invalid, 0, 0);
+            return;
+        }
+
+        std::size_t pos = blank.span(text);
+        while (pos < text.size())
+        {
+            const char c = text[pos];
+            std::size_t n = 1;
+
+            if (classes::lower(c))
+            {
+                n += word.span(text.substr(pos + 1));
+                const auto w = text.substr(pos, n);
+                const auto k = lexing::word_kind(w);
+                out.push(k, pos, n, k == kind::identifier ? out.intern(w) : 0);
+            }
+            else if (classes::digit(c))
+            {
+                const input_t at{text, pos};
+                auto r = real(at);
+                if (!r.is_empty())
+                {
+                    n = r.remain.pos - pos;
+                    out.push(kind::real, pos, n, out.add_literal(r.get()));
+                }
+                else if (r.committed)
+                {
+                    // a real out of range is invalid, not an integer and a stray exponent
+                    n = real.scan(at).remain.pos - pos;
+                    out.push(kind::invalid, pos, n);
+                }
+                else if (auto i = integer(at); !i.is_empty())
+                {
+                    n = i.remain.pos - pos;
+                    out.push(kind::integer, pos, n, out.add_literal(i.get()));
+                }
+                else
+                {
+                    // out of range: the whole literal is invalid
+                    n = integer.scan(at).remain.pos - pos;
+                    out.push(kind::invalid, pos, n);
+                }
+            }
+            else if (c == '"')
+            {
+                const auto m = content.span(text.substr(pos + 1));
+                if (pos + 1 + m < text.size() && text[pos + 1 + m] == '"')
+                {
+                    n = m + 2;
+                    out.push(kind::string, pos, n, out.intern(text.substr(pos + 1, m)));
+                }
+                else
+                {
+                    out.push(kind::invalid, pos, n);
+                }
+            }
+            else
+            {
+                const auto m = lexing::punctuation_trie().longest(text.substr(pos));
+                if (m.word != literal_trie_t::none)
+                {
+                    n = m.length;
+                    out.push(lexing::punctuation()[m.word].kind, pos, n);
+                }
+                else
+                {
+                    out.push(kind::invalid, pos, n);
+                }
+            }
+
+            pos += n;
+            pos += blank.span(text.substr(pos));
+        }
+    }
+
+    inline token_stream_t lex(std::string_view text)
+    {
+        token_stream_t out;
+        lex(text, out);
+        return out;
+    }
+
+
+    // operators() spelled as token kinds, in the same order: an index means the same operator
+    inline const std::vector<operator_def_t>& token_operators()
+    {
+        static const std::vector<operator_def_t> table{[] {
+            std::vector<operator_def_t> ops;
+            for (const auto& op : operators())
+                ops.push_back(operator_def_t{std::string(1, lexing::kind_of(op.token)), op.precedence, op.assoc});
+            return ops;
+        }()};
+        return table;
+    }
+
+
+    /*
+     * the kpml grammar over the tokens of lex(), with the node builders of
+     * the text grammar. No rule skips blanks or scans a literal, and an
+     * identifier is read once whether or not a call follows it, so nothing
+     * is re-parsed and no rule is memoized.
+     */
+    namespace lexed
+    {
+        namespace grammar
+        {
+            template <typename B> using result_t = parser_t<typename B::node_t>;
+
+            template <typename B> inline result_t<B> expr(input_t inp);
+            template <typename B> inline result_t<B> statement(input_t inp);
+
+
+            inline parser_t<std::string_view> name(input_t inp)
+            {
+                static const auto p = fmap(kind_eq(kind::identifier, "identifier"), [](const lexeme_t& t) {
+                    return current_tokens().name(t.id);
+                });
+                return parse(p, inp);
+            }
+
+
+            // the parser of factor, an object whose FIRST set choice() can read
+            template <typename B>
+            inline const auto& factor_parser()
+            {
+                using args_t = std::optional<std::vector<typename B::node_t>>;
+
+                static const auto p = named("lexed::factor", nested(choice(
+                        fmap(
+                            seq(kind_eq('('), expr<B>, kind_eq(')')),
+                            [](auto x) { return std::get<1>(std::move(x)); }
+                        ),
+                        fmap(
+                            seq(
+                                starts_with(char_class_t::of(std::string_view{&kind::identifier, 1}), name),
+                                pipe(
+                                    fmap(
+                                        seq(kind_eq('('), sep_by1(expr<B>, kind_eq(',')), kind_eq(')')),
+                                        [](auto x) { return args_t{std::get<1>(std::move(x))}; }
+                                    ),
+                                    pure(args_t{})
+                                )
+                            ),
+                            [](auto x) {
+                                auto& args = std::get<1>(x);
+                                return args ? B::apply(std::get<0>(x), std::move(*args)) : B::symbol(std::get<0>(x));
+                            }
+                        ),
+                        fmap(kind_eq(kind::real, "number"), [](const lexeme_t& t) {
+                            return B::number(std::get<double>(current_tokens().literal(t.id)));
+                        }),
+                        fmap(kind_eq(kind::integer, "number"), [](const lexeme_t& t) {
+                            return B::number(std::get<std::uint64_t>(current_tokens().literal(t.id)));
+                        }),
+                        fmap(kind_eq(kind::string, "string"), [](const lexeme_t& t) {
+                            return B::string(current_tokens().name(t.id));
+                        })
+                )));
+
+                return p;
+            }
+
+            template <typename B>
+            inline result_t<B> factor(input_t inp)
+            {
+                return parse(factor_parser<B>(), inp);
+            }
+
+
+            template <typename B>
+            inline result_t<B> expr(input_t inp)
+            {
+                static const auto p = named("lexed::expr", expression(factor<B>, token_operators(), B::binary));
+                return parse(p, inp);
+            }
+
+
+            template <typename B>
+            inline const auto& if_else_parser()
+            {
+                static const auto p = named("lexed::if_else", fmap(
+                        seq(
+                            kind_eq(kind::kw_if, "\"if\""),
+                            cut,
+                            kind_eq('('),
+                            expr<B>,
+                            kind_eq(')'),
+                            kind_eq('{'),
+                            statement<B>,
+                            kind_eq('}'),
+                            kind_eq(kind::kw_else, "\"else\""),
+                            kind_eq('{'),
+                            statement<B>,
+                            kind_eq('}')
+                        ),
+                        [](auto x) {
+                            return B::if_else(
+                                    std::get<2>(std::move(x)),
+                                    std::get<5>(std::move(x)),
+                                    std::get<9>(std::move(x))
+                            );
+                        }
+                ));
+
+                return p;
+            }
+
+            template <typename B>
+            inline result_t<B> if_else(input_t inp)
+            {
+                return parse(if_else_parser<B>(), inp);
+            }
+
+
+            template <typename B>
+            inline result_t<B> statement(input_t inp)
+            {
+                // the rules are functions choice() cannot look into: each declares where its parser starts
+                static const auto p = named("lexed::statement", nested(choice(
+                        starts_with(first_of(if_else_parser<B>()).chars, if_else<B>),
+                        starts_with(first_of(factor_parser<B>()).chars, expr<B>)
+                )));
+                return parse(p, inp);
+            }
+
+
+            template <typename B>
+            inline result_t<B> function_body(input_t inp)
+            {
+                static const auto p = named("lexed::function_body", fmap(
+                        sep_by1(statement<B>, kind_eq(';')),
+                        [](std::vector<typename B::node_t> statements) { return B::begin(std::move(statements)); }
+                ));
+
+                return parse(p, inp);
+            }
+
+
+            template <typename B>
+            inline result_t<B> function_def(input_t inp)
+            {
+                static const auto p = named("lexed::function_def", fmap(
+                        seq(
+                            kind_eq(kind::kw_def, "\"def\""),
+                            cut,
+                            name,
+                            kind_eq('('),
+                            sep_by1(name, kind_eq(',')),
+                            kind_eq(')'),
+                            kind_eq('{'),
+                            function_body<B>,
+                            kind_eq('}')
+                        ),
+                        [](auto x) {
+                            return B::def(std::get<1>(x), std::get<3>(x), std::get<6>(std::move(x)));
+                        }
+                ));
+
+                return parse(p, inp);
+            }
+        }
+
+
+        /* the statement_t grammar, run with parse(rule, tokens) */
+
+        inline parser_t<statement_t> expr(input_t inp) { return grammar::expr<tree_builder_t>(inp); }
+        inline parser_t<statement_t> statement(input_t inp) { return grammar::statement<tree_builder_t>(inp); }
+        inline parser_t<statement_t> function_body(input_t inp) { return grammar::function_body<tree_builder_t>(inp); }
+        inline parser_t<statement_t> function_def(input_t inp) { return grammar::function_def<tree_builder_t>(inp); }
+    }
+}
+
+#endif //PARSER_KPML_LEXER_HPP_H
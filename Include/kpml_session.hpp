@@ -0,0 +1,169 @@
+//
+// Batched parsing of many short kpml inputs with reused scratch state
+//
+
+#ifndef PARSER_KPML_SESSION_HPP_H
+#define PARSER_KPML_SESSION_HPP_H
+
+#include "kpml_ast.hpp"
+#include "lparser_parallel.hpp"
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+
+namespace kpml
+{
+    enum class parse_status_t : std::uint8_t
+    {
+        ok,        // the whole input is one statement
+        partial,   // a statement, followed by text it does not take
+        invalid    // no statement
+    };
+
+    /*
+     * the results of a batch, one entry per input in each array: the status,
+     * the bytes consumed (where the parse stopped when invalid) and the root
+     * node, meaningful unless invalid, in the ast of the shard that parsed it.
+     * consumed is 32 bits: an input over parser_session_t::max_input is not
+     * parsed, and comes out invalid with nothing consumed.
+     */
+    struct batch_result_t
+    {
+        std::vector<parse_status_t> status;
+        std::vector<std::uint32_t> consumed;
+        std::vector<ast_t::node_id> root;
+
+        std::size_t size() const { return status.size(); }
+
+        void resize(std::size_t n)
+        {
+            status.resize(n);
+            consumed.resize(n);
+            root.resize(n);
+        }
+    };
+
+
+    /*
+     * parses batches of inputs with one rule of kpml::arena, reusing everything
+     * from one batch to the next: each shard runs in its own parse context and
+     * owns an ast that is cleared, not reallocated, and the result arrays keep
+     * their capacity. There is no packrat table: a short input backtracks too
+     * little for a hit to pay for the lookups. Names stay interned across
+     * batches, up to atom_limit per shard.
+     * Inputs are split into contiguous shards; with more than one thread the
+     * shards run on a work pool. Trees stay valid until the next batch.
+     */
+    class parser_session_t
+    {
+    public:
+        static constexpr std::size_t atom_limit = 1 << 16;
+        static constexpr std::size_t max_input = std::numeric_limits<std::uint32_t>::max();
+
+        // a few shards per thread, so stealing can even out slow ones
+        explicit parser_session_t(std::size_t threads = 1)
+        : shards(threads > 1 ? 4 * threads : 1)
+        {
+            if (threads > 1)
+                pool = std::make_unique<work_pool_t>(threads);
+        }
+
+        // inputs is any contiguous range of things viewable as std::string_view
+        template<typename Range>
+        const batch_result_t& parse(const Range& inputs)
+        {
+            return parse(inputs, arena::statement);
+        }
+
+        template<typename Range, typename P>
+        const batch_result_t& parse(const Range& inputs, const P& p)
+        {
+            const auto* first = std::data(inputs);
+            const auto n = static_cast<std::size_t>(std::size(inputs));
+            results.resize(n);
+            count = n;
+
+            const auto run = [&](std::size_t k) {
+                auto& s = shards[k];
+                s.ast.clear();
+                if (s.ast.interner().size() > atom_limit)
+                    s.ast.interner().clear();
+                context_scope in_shard{s.context};
+                ast_scope in_ast{s.ast};
+                for (std::size_t i = shard_begin(k); i < shard_begin(k + 1); ++i)
+                    one(std::string_view{first[i]}, p, i);
+            };
+
+            if (pool && n > shards.size())
+            {
+                pool->for_each(shards.size(), run);
+            }
+            else
+            {
+                for (std::size_t k = 0; k < shards.size(); ++k)
+                    run(k);
+            }
+            return results;
+        }
+
+        const batch_result_t& result() const { return results; }
+
+        // the ast holding the tree of input i of the last batch
+        const ast_t& ast(std::size_t i) const { return shards[shard_of(i)].ast; }
+
+    private:
+        struct shard_t
+        {
+            parse_context_t context;
+            ast_t ast;
+        };
+
+        std::size_t shard_begin(std::size_t k) const { return count * k / shards.size(); }
+
+        std::size_t shard_of(std::size_t i) const
+        {
+            std::size_t k = i * shards.size() / count;
+            while (shard_begin(k + 1) <= i)
+                ++k;
+            while (shard_begin(k) > i)
+                --k;
+            return k;
+        }
+
+        template<typename P>
+        void one(std::string_view text, const P& p, std::size_t i)
+        {
+            if (text.size() > max_input)
+            {
+                results.status[i] = parse_status_t::invalid;
+                results.consumed[i] = 0;
+                results.root[i] = 0;
+                return;
+            }
+
+            const auto r = lparser::parse(p, text);
+            if (r.is_empty())
+            {
+                results.status[i] = parse_status_t::invalid;
+                results.root[i] = 0;
+            }
+            else
+            {
+                results.status[i] = r.remain.empty() ? parse_status_t::ok : parse_status_t::partial;
+                results.root[i] = *r.first;
+            }
+            results.consumed[i] = static_cast<std::uint32_t>(r.remain.pos);
+        }
+
+        std::unique_ptr<work_pool_t> pool;
+        std::vector<shard_t> shards;
+        batch_result_t results;
+        std::size_t count{};
+    };
+}
+
+#endif //PARSER_KPML_SESSION_HPP_H
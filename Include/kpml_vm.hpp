@@ -0,0 +1,701 @@
+//
+// kpml compiled to stack bytecode, and the VM that runs it
+//
+
+#ifndef PARSER_KPML_VM_HPP_H
+#define PARSER_KPML_VM_HPP_H
+
+#include "kpml.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KPML_VM_COMPUTED_GOTO 1
+#endif
+
+
+namespace kpml
+{
+    namespace vm
+    {
+        struct value_t
+        {
+            enum class kind_t : std::uint8_t { integer, real, string };
+
+            static value_t integer(std::uint64_t v) { value_t x; x.kind = kind_t::integer; x.u = v; return x; }
+            static value_t real(double v) { value_t x; x.kind = kind_t::real; x.d = v; return x; }
+            static value_t string(const std::string* v) { value_t x; x.kind = kind_t::string; x.s = v; return x; }
+
+            kind_t kind{kind_t::integer};
+            union
+            {
+                std::uint64_t u{};
+                double d;
+                const std::string* s;   // owned by the program
+            };
+        };
+
+        inline std::ostream& operator<<(std::ostream& out, const value_t& v)
+        {
+            switch (v.kind)
+            {
+                case value_t::kind_t::integer: return out << v.u;
+                case value_t::kind_t::real: return out << v.d;
+                case value_t::kind_t::string: return out << '"' << *v.s << '"';
+            }
+            return out;
+        }
+
+
+        /*
+         * the meaning of the operators, the one kpml::simplify folds by: integers
+         * wrap around, mix with reals as reals; comparisons, && and || give 1 or 0;
+         * == also compares strings. Division by 0, "in", "!" and any other
+         * operand kind are errors. op indexes operators().
+         */
+        inline bool truth(const value_t& v, bool& b)
+        {
+            switch (v.kind)
+            {
+                case value_t::kind_t::integer: b = v.u != 0; return true;
+                case value_t::kind_t::real: b = v.d != 0.0; return true;
+                default: return false;
+            }
+        }
+
+        // false on an error, with out unchanged
+        inline bool binary(std::size_t op, const value_t& a, const value_t& b, value_t& out)
+        {
+            enum : std::size_t { add, sub, gt, lt, ge, le, eq, mul, div, in, bang, and_, or_ };
+            using kind_t = value_t::kind_t;
+
+            if (op == and_ || op == or_)
+            {
+                bool x, y;
+                if (!truth(a, x) || !truth(b, y))
+                    return false;
+                out = value_t::integer(op == and_ ? x && y : x || y);
+                return true;
+            }
+
+            if (a.kind == kind_t::string || b.kind == kind_t::string)
+            {
+                if (op != eq)
+                    return false;
+                out = value_t::integer(a.kind == b.kind && *a.s == *b.s);
+                return true;
+            }
+
+            if (a.kind == kind_t::integer && b.kind == kind_t::integer)
+            {
+                const auto x = a.u, y = b.u;
+                switch (op)
+                {
+                    case add: out = value_t::integer(x + y); return true;
+                    case sub: out = value_t::integer(x - y); return true;
+                    case mul: out = value_t::integer(x * y); return true;
+                    case div:
+                        if (y == 0)
+                            return false;
+                        out = value_t::integer(x / y);
+                        return true;
+                    case gt: out = value_t::integer(x > y); return true;
+                    case lt: out = value_t::integer(x < y); return true;
+                    case ge: out = value_t::integer(x >= y); return true;
+                    case le: out = value_t::integer(x <= y); return true;
+                    case eq: out = value_t::integer(x == y); return true;
+                    default: return false;
+                }
+            }
+
+            const auto x = a.kind == kind_t::real ? a.d : static_cast<double>(a.u);
+            const auto y = b.kind == kind_t::real ? b.d : static_cast<double>(b.u);
+            switch (op)
+            {
+                case add: out = value_t::real(x + y); return true;
+                case sub: out = value_t::real(x - y); return true;
+                case mul: out = value_t::real(x * y); return true;
+                case div:
+                    if (y == 0.0)
+                        return false;
+                    out = value_t::real(x / y);
+                    return true;
+                case gt: out = value_t::integer(x > y); return true;
+                case lt: out = value_t::integer(x < y); return true;
+                case ge: out = value_t::integer(x >= y); return true;
+                case le: out = value_t::integer(x <= y); return true;
+                case eq: out = value_t::integer(x == y); return true;
+                default: return false;
+            }
+        }
+
+
+        // the binary operators come first, in the order of operators()
+        enum class op_t : std::uint8_t
+        {
+            add, sub, gt, lt, ge, le, eq, mul, div, in, bang, and_, or_,
+            constant, load, jump, jump_if_false, call, native, ret, pop
+        };
+
+        struct instr_t
+        {
+            op_t op;
+            std::uint32_t a;   // constant, slot, jump target, function
+            std::uint32_t b;   // argument count of a call
+        };
+
+        using native_fn = bool (*)(const value_t* args, value_t& out);
+
+        // a host function callable from kpml; it returns false on an error
+        struct native_t
+        {
+            std::string name;
+            std::size_t arity;
+            native_fn fn;
+        };
+
+        struct function_t
+        {
+            std::string name;
+            std::uint32_t entry;
+            std::uint32_t arity;
+            std::uint32_t max_stack;   // values the body pushes at most beyond its arguments
+        };
+
+        /*
+         * string constants point into strings, whose elements a move keeps in
+         * place and a copy would not: a program moves, it is never copied
+         */
+        struct program_t
+        {
+            program_t() = default;
+            program_t(program_t&&) = default;
+            program_t& operator=(program_t&&) = default;
+
+            program_t(const program_t&) = delete;
+            program_t& operator=(const program_t&) = delete;
+
+            std::vector<instr_t> code;
+            std::vector<value_t> constants;
+            std::deque<std::string> strings;   // element addresses are stable
+            std::vector<function_t> functions;
+            std::vector<native_t> natives;
+            std::string error;                 // why compile failed; empty on success
+
+            explicit operator bool() const { return error.empty(); }
+
+            // the index of the function called name, or functions.size()
+            std::size_t find(std::string_view name) const
+            {
+                for (std::size_t i = 0; i < functions.size(); ++i)
+                {
+                    if (functions[i].name == name)
+                        return i;
+                }
+                return functions.size();
+            }
+        };
+
+
+        namespace detail
+        {
+            // compiles one def: names are resolved here, so the code holds only indices
+            class compiler_t
+            {
+            public:
+                compiler_t(program_t& p, const std::unordered_map<std::string, std::size_t>& fns,
+                           const std::unordered_map<std::string, std::size_t>& nats)
+                : prog(p), functions(fns), natives(nats)
+                {}
+
+                // d checked by compile(): a name, a parameters node of symbols and a body
+                bool def(const statement_t& d, function_t& f)
+                {
+                    slots.clear();
+                    for (const auto& p : d.operands[1].operands)
+                        slots.emplace(p.leaf_if<symbol_t>()->name, static_cast<std::uint32_t>(slots.size()));
+
+                    depth = max_depth = 0;
+                    f.entry = static_cast<std::uint32_t>(prog.code.size());
+                    if (!statement(d.operands[2]))
+                        return false;
+                    emit(op_t::ret, 0, 0, 0);
+                    f.max_stack = static_cast<std::uint32_t>(max_depth);
+                    return true;
+                }
+
+            private:
+                bool fail(std::string why)
+                {
+                    prog.error = std::move(why);
+                    return false;
+                }
+
+                std::size_t emit(op_t op, std::uint32_t a, std::uint32_t b, int effect)
+                {
+                    prog.code.push_back(instr_t{op, a, b});
+                    depth += effect;
+                    max_depth = std::max(max_depth, depth);
+                    return prog.code.size() - 1;
+                }
+
+                void constant(value_t v)
+                {
+                    prog.constants.push_back(v);
+                    emit(op_t::constant, static_cast<std::uint32_t>(prog.constants.size() - 1), 0, 1);
+                }
+
+                static std::size_t operator_index(const std::string& op)
+                {
+                    const auto& ops = operators();
+                    for (std::size_t i = 0; i < ops.size(); ++i)
+                    {
+                        if (ops[i].token == op)
+                            return i;
+                    }
+                    return ops.size();
+                }
+
+                /*
+                 * s compiled with a work list instead of recursion: a flat sum of
+                 * many terms is a tree as deep as it is long. Steps pop in the
+                 * order the recursive compiler would have run them; the jumps
+                 * an if leaves open wait on marks, innermost last.
+                 */
+                bool statement(const statement_t& s)
+                {
+                    work.clear();
+                    marks.clear();
+                    work.push_back(task_t{step_t::node, &s, 0});
+                    while (!work.empty())
+                    {
+                        const auto t = work.back();
+                        work.pop_back();
+                        switch (t.step)
+                        {
+                            case step_t::node:
+                                if (!node(*t.node))
+                                    return false;
+                                break;
+                            case step_t::binary:
+                                emit(static_cast<op_t>(t.op), 0, 0, -1);
+                                break;
+                            case step_t::apply:
+                                if (!apply(*t.node))
+                                    return false;
+                                break;
+                            case step_t::pop:
+                                emit(op_t::pop, 0, 0, -1);
+                                break;
+                            case step_t::if_test:
+                                marks.push_back(emit(op_t::jump_if_false, 0, 0, -1));
+                                break;
+                            case step_t::if_else:
+                            {
+                                const auto done = emit(op_t::jump, 0, 0, -1);
+                                prog.code[marks.back()].a = static_cast<std::uint32_t>(prog.code.size());
+                                marks.back() = done;
+                                break;
+                            }
+                            case step_t::if_end:
+                                prog.code[marks.back()].a = static_cast<std::uint32_t>(prog.code.size());
+                                marks.pop_back();
+                                break;
+                        }
+                    }
+                    return true;
+                }
+
+                // s itself, or the steps that compile it pushed in reverse
+                bool node(const statement_t& s)
+                {
+                    if (s.is_leaf())
+                        return leaf(s);
+
+                    if (s.op == "if" && s.operands.size() == 3)
+                    {
+                        work.push_back(task_t{step_t::if_end, &s, 0});
+                        work.push_back(task_t{step_t::node, &s.operands[2], 0});
+                        work.push_back(task_t{step_t::if_else, &s, 0});
+                        work.push_back(task_t{step_t::node, &s.operands[1], 0});
+                        work.push_back(task_t{step_t::if_test, &s, 0});
+                        work.push_back(task_t{step_t::node, &s.operands[0], 0});
+                        return true;
+                    }
+
+                    if (s.op == "begin")
+                    {
+                        if (s.operands.empty())
+                            return fail("empty begin");
+                        for (auto i = s.operands.size(); i-- > 0; )
+                        {
+                            work.push_back(task_t{step_t::node, &s.operands[i], 0});
+                            if (i > 0)
+                                work.push_back(task_t{step_t::pop, &s, 0});
+                        }
+                        return true;
+                    }
+
+                    if (s.op == "apply" && !s.operands.empty() && s.operands[0].leaf_if<symbol_t>())
+                    {
+                        work.push_back(task_t{step_t::apply, &s, 0});
+                        for (auto i = s.operands.size(); i-- > 1; )
+                            work.push_back(task_t{step_t::node, &s.operands[i], 0});
+                        return true;
+                    }
+
+                    const auto op = operator_index(s.op);
+                    if (op < operators().size() && s.operands.size() == 2)
+                    {
+                        work.push_back(task_t{step_t::binary, &s, op});
+                        work.push_back(task_t{step_t::node, &s.operands[1], 0});
+                        work.push_back(task_t{step_t::node, &s.operands[0], 0});
+                        return true;
+                    }
+
+                    return fail("cannot compile \"" + s.op + "\"");
+                }
+
+                bool leaf(const statement_t& s)
+                {
+                    if (const auto u = s.leaf_if<std::uint64_t>())
+                    {
+                        constant(value_t::integer(*u));
+                    }
+                    else if (const auto d = s.leaf_if<double>())
+                    {
+                        constant(value_t::real(*d));
+                    }
+                    else if (const auto str = s.leaf_if<std::string>())
+                    {
+                        prog.strings.push_back(*str);
+                        constant(value_t::string(&prog.strings.back()));
+                    }
+                    else
+                    {
+                        const auto& name = s.leaf_if<symbol_t>()->name;
+                        const auto it = slots.find(name);
+                        if (it == slots.end())
+                            return fail("unknown symbol " + name);
+                        emit(op_t::load, it->second, 0, 1);
+                    }
+                    return true;
+                }
+
+                // the call of an apply whose arguments are on the stack
+                bool apply(const statement_t& s)
+                {
+                    const auto& name = s.operands[0].leaf_if<symbol_t>()->name;
+                    const auto argc = s.operands.size() - 1;
+
+                    const auto effect = 1 - static_cast<int>(argc);
+                    if (const auto f = functions.find(name); f != functions.end())
+                    {
+                        if (prog.functions[f->second].arity != argc)
+                            return fail(name + " takes " + std::to_string(prog.functions[f->second].arity) + " arguments");
+                        emit(op_t::call, static_cast<std::uint32_t>(f->second), static_cast<std::uint32_t>(argc), effect);
+                        return true;
+                    }
+                    if (const auto n = natives.find(name); n != natives.end())
+                    {
+                        if (prog.natives[n->second].arity != argc)
+                            return fail(name + " takes " + std::to_string(prog.natives[n->second].arity) + " arguments");
+                        emit(op_t::native, static_cast<std::uint32_t>(n->second), static_cast<std::uint32_t>(argc), effect);
+                        return true;
+                    }
+                    return fail("unknown function " + name);
+                }
+
+                enum class step_t : std::uint8_t { node, binary, apply, pop, if_test, if_else, if_end };
+
+                struct task_t
+                {
+                    step_t step;
+                    const statement_t* node;
+                    std::size_t op;   // the operator of a binary step
+                };
+
+                program_t& prog;
+                const std::unordered_map<std::string, std::size_t>& functions;
+                const std::unordered_map<std::string, std::size_t>& natives;
+                std::unordered_map<std::string, std::uint32_t> slots;
+                std::vector<task_t> work;
+                std::vector<std::size_t> marks;   // jumps of the ifs being compiled, to patch
+                int depth{}, max_depth{};
+            };
+        }
+
+
+        /*
+         * the defs compiled to one program. Every def is declared before any body
+         * is compiled, so calls may go forward and recurse; a name that is no def
+         * is looked up in natives. Symbols become parameter slots, operators and
+         * functions indices: nothing is looked up by name at run time.
+         */
+        inline program_t compile(const std::vector<statement_t>& defs, std::vector<native_t> natives = {})
+        {
+            program_t prog;
+            prog.natives = std::move(natives);
+
+            std::unordered_map<std::string, std::size_t> functions, nats;
+            for (std::size_t i = 0; i < prog.natives.size(); ++i)
+                nats.emplace(prog.natives[i].name, i);
+
+            for (const auto& d : defs)
+            {
+                if (d.op != "def" || d.operands.size() != 3 || !d.operands[0].leaf_if<std::string>())
+                {
+                    prog.error = "not a def";
+                    return prog;
+                }
+                const auto& name = *d.operands[0].leaf_if<std::string>();
+                const auto& params = d.operands[1];
+                if (params.op != "parameters" || !std::all_of(params.operands.begin(), params.operands.end(),
+                                                               [](const statement_t& p) { return p.leaf_if<symbol_t>() != nullptr; }))
+                {
+                    prog.error = "malformed parameters of def " + name;
+                    return prog;
+                }
+                if (!functions.emplace(name, prog.functions.size()).second)
+                {
+                    prog.error = "duplicate def " + name;
+                    return prog;
+                }
+                prog.functions.push_back(function_t{name, 0, static_cast<std::uint32_t>(d.operands[1].operands.size()), 0});
+            }
+
+            detail::compiler_t c{prog, functions, nats};
+            for (std::size_t i = 0; i < defs.size(); ++i)
+            {
+                if (!c.def(defs[i], prog.functions[i]))
+                    return prog;
+            }
+            return prog;
+        }
+
+
+        /*
+         * runs the functions of a program. Values live on one fixed stack: a call
+         * checks there is room for the callee's max_stack, so a deep recursion
+         * ends in an error instead of overflowing anything.
+         */
+        class machine_t
+        {
+        public:
+            explicit machine_t(const program_t& p, std::size_t stack_size = 1 << 16)
+            : prog(p), stack(stack_size)
+            {}
+
+            // the value of function name applied to args, or nothing and error() tells why
+            std::optional<value_t> call(std::string_view name, std::initializer_list<value_t> args)
+            {
+                return call(prog.find(name), args.begin(), args.size());
+            }
+
+            std::optional<value_t> call(std::size_t f, const value_t* args, std::size_t argc)
+            {
+                why.clear();
+                if (f >= prog.functions.size())
+                    return failure("unknown function");
+                if (argc != prog.functions[f].arity)
+                    return failure("wrong number of arguments");
+                if (argc + prog.functions[f].max_stack > stack.size())
+                    return failure("stack overflow");
+
+                std::copy(args, args + argc, stack.begin());
+                return run(f, argc);
+            }
+
+            const std::string& error() const { return why; }
+
+        private:
+            struct frame_t
+            {
+                const instr_t* ret;
+                value_t* base;
+            };
+
+            std::optional<value_t> failure(const char* what)
+            {
+                why = what;
+                return std::nullopt;
+            }
+
+            std::optional<value_t> run(std::size_t f, std::size_t argc);
+
+            const program_t& prog;
+            std::vector<value_t> stack;
+            std::vector<frame_t> frames;
+            std::string why;
+        };
+
+
+        inline std::optional<value_t> machine_t::run(std::size_t f, std::size_t argc)
+        {
+            const instr_t* const code = prog.code.data();
+            const value_t* const constants = prog.constants.data();
+            value_t* const limit = stack.data() + stack.size();
+
+            const instr_t* pc = code + prog.functions[f].entry;
+            value_t* fp = stack.data();
+            value_t* sp = fp + argc;
+            frames.clear();
+
+            const char* what = nullptr;
+
+#ifdef KPML_VM_COMPUTED_GOTO
+            static void* const labels[] = {
+                    &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary,
+                    &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary,
+                    &&op_constant, &&op_load, &&op_jump, &&op_jump_if_false, &&op_call, &&op_native, &&op_ret, &&op_pop
+            };
+#define KPML_VM_CASE(name) op_##name:
+#define KPML_VM_NEXT goto *labels[static_cast<std::size_t>(pc->op)]
+            KPML_VM_NEXT;
+#else
+#define KPML_VM_CASE(name) case_##name:
+#define KPML_VM_NEXT goto dispatch
+        dispatch:
+            switch (pc->op)
+            {
+                case op_t::constant: goto case_constant;
+                case op_t::load: goto case_load;
+                case op_t::jump: goto case_jump;
+                case op_t::jump_if_false: goto case_jump_if_false;
+                case op_t::call: goto case_call;
+                case op_t::native: goto case_native;
+                case op_t::ret: goto case_ret;
+                case op_t::pop: goto case_pop;
+                default: goto case_binary;
+            }
+#endif
+
+            KPML_VM_CASE(binary)
+            {
+                value_t& a = sp[-2];
+                const value_t& b = sp[-1];
+                if (a.kind == value_t::kind_t::integer && b.kind == value_t::kind_t::integer)
+                {
+                    const auto x = a.u, y = b.u;
+                    switch (pc->op)
+                    {
+                        case op_t::add: a.u = x + y; goto binary_done;
+                        case op_t::sub: a.u = x - y; goto binary_done;
+                        case op_t::mul: a.u = x * y; goto binary_done;
+                        case op_t::lt: a.u = x < y; goto binary_done;
+                        case op_t::gt: a.u = x > y; goto binary_done;
+                        case op_t::eq: a.u = x == y; goto binary_done;
+                        default: break;
+                    }
+                }
+                if (!binary(static_cast<std::size_t>(pc->op), a, b, a))
+                {
+                    what = "invalid operands";
+                    goto fail;
+                }
+            binary_done:
+                --sp;
+                ++pc;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(constant)
+            {
+                *sp++ = constants[pc->a];
+                ++pc;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(load)
+            {
+                *sp++ = fp[pc->a];
+                ++pc;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(jump)
+            {
+                pc = code + pc->a;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(jump_if_false)
+            {
+                bool b;
+                if (!truth(*--sp, b))
+                {
+                    what = "condition is not a number";
+                    goto fail;
+                }
+                pc = b ? pc + 1 : code + pc->a;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(call)
+            {
+                const auto& callee = prog.functions[pc->a];
+                value_t* base = sp - pc->b;
+                if (base + pc->b + callee.max_stack > limit)
+                {
+                    what = "stack overflow";
+                    goto fail;
+                }
+                frames.push_back(frame_t{pc + 1, fp});
+                fp = base;
+                pc = code + callee.entry;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(native)
+            {
+                value_t* base = sp - pc->b;
+                value_t out;
+                if (!prog.natives[pc->a].fn(base, out))
+                {
+                    what = "native call failed";
+                    goto fail;
+                }
+                *base = out;
+                sp = base + 1;
+                ++pc;
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(ret)
+            {
+                const value_t result = sp[-1];
+                if (frames.empty())
+                    return result;
+
+                sp = fp;
+                *sp++ = result;
+                pc = frames.back().ret;
+                fp = frames.back().base;
+                frames.pop_back();
+                KPML_VM_NEXT;
+            }
+
+            KPML_VM_CASE(pop)
+            {
+                --sp;
+                ++pc;
+                KPML_VM_NEXT;
+            }
+
+#undef KPML_VM_CASE
+#undef KPML_VM_NEXT
+
+        fail:
+            return failure(what);
+        }
+    }
+}
+
+#endif //PARSER_KPML_VM_HPP_H
@@ -7,12 +7,18 @@
 #define PARSER_LPARSER_H_H
 
 #include "omega.hpp"
+#include "lparser_charset.hpp"
+#include "lparser_error.hpp"
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
 #include <algorithm>
-#include <numeric>
-#include <cmath>
 #include <memory>
+#include <optional>
+#include <limits>
+#include <functional>
 #include <vector>
 
 
@@ -20,293 +26,917 @@
 namespace lparser
 {
 
-    template<typename T>
-    struct parser_t
+    /* input cursor: a position over an immutable buffer owned by the caller */
+
+    struct input_t
     {
-        using value_t = T;
+        input_t() = default;
 
-        parser_t()
-        {
-            first = nullptr;
-            empty = true;
-        }
+        explicit input_t(std::string_view b, std::size_t p = 0)
+        : buffer(b), pos(p)
+        {}
+
+        bool empty() const { return pos >= buffer.size(); }
+        std::size_t size() const { return buffer.size() - pos; }
+        std::size_t offset() const { return pos; }
 
-        explicit parser_t(T a, std::string r = "")
-        : remain(r)
+        char peek() const { return buffer[pos]; }
+        std::string_view rest() const { return buffer.substr(pos); }
+
+        input_t advance(std::size_t n) const { return input_t{buffer, pos + n}; }
+
+        // the text consumed between this cursor and a later one
+        std::string_view upto(const input_t& last) const
         {
-            first = std::make_unique<T>(std::move(a));
-            empty = false;
+            return buffer.substr(pos, last.pos - pos);
         }
 
-        parser_t(const parser_t &rhs)
+        bool operator==(const input_t& rhs) const
         {
-            empty = rhs.empty;
-            if (!empty)
-            {
-                remain = rhs.remain;
-                first = std::make_unique<T>(rhs.get());
-            }
-            else
-            {
-                remain = "";
-            }
+            return pos == rhs.pos && buffer.data() == rhs.buffer.data();
         }
 
-        bool is_empty() const { return empty; }
-        T get() const { return *first; }
+        bool operator!=(const input_t& rhs) const { return !(*this == rhs); }
 
-        std::unique_ptr<T> first;
-        std::string remain;
+        std::string_view buffer;
+        std::size_t pos{};
+    };
 
-    private:
-        bool empty;
+    inline std::ostream& operator<<(std::ostream& out, const input_t& inp)
+    {
+        return out << inp.rest();
+    }
+
+    // report what a failing primitive wanted at inp (a no-op unless diagnosing)
+    inline void expected(const input_t& inp, std::string_view what)
+    {
+        if (auto f = failure_t::active())
+            detail::record_failure(*f, inp.pos, what);
+    }
+
+
+    template<typename T>
+    struct parser_t
+    {
+        using value_t = T;
+
+        parser_t() = default;
+
+        explicit parser_t(T a, input_t r = {})
+        : first(std::move(a)), remain(r)
+        {}
+
+        parser_t(parser_t&&) = default;
+        parser_t& operator=(parser_t&&) = default;
+
+        parser_t(const parser_t&) = delete;
+        parser_t& operator=(const parser_t&) = delete;
+
+        bool is_empty() const { return !first.has_value(); }
+
+        const T& get() const & { return *first; }
+        T& get() & { return *first; }
+        T&& get() && { return std::move(*first); }
+
+        std::optional<T> first;
+        input_t remain;
+        bool committed{false};   // a failure past a cut: enclosing alternatives are not tried
     };
 
     template<typename T>
     parser_t<T> empty() { return parser_t<T>{}; }
 
     template<typename T>
-    parser_t<T> empty(const std::string& remain)
+    parser_t<T> empty(const input_t& remain)
     {
         auto p = parser_t<T>{};
         p.remain = remain;
         return p;
     }
 
+    // the failure of a step propagated by its enclosing parser, commitment included
+    template<typename T, typename U>
+    parser_t<T> empty(const parser_t<U>& failed)
+    {
+        auto p = empty<T>(failed.remain);
+        p.committed = failed.committed;
+        return p;
+    }
+
     template<typename T>
-    parser_t<T> empty_fn(std::string) { return parser_t<T>{}; }
+    parser_t<T> empty_fn(input_t) { return parser_t<T>{}; }
 
     template<typename Parser>
-    decltype(auto) parse(Parser && p, std::string inp)
+    decltype(auto) parse(Parser && p, input_t inp)
     {
         return p(inp);
     }
 
+    namespace detail
+    {
+        // the cursor a top-level parse of text starts from: a new generation of the current context
+        inline input_t start(std::string_view text)
+        {
+            ++parse_context_t::current().generation;
+            return input_t{text};
+        }
+    }
+
+    // the result refers into the text: it has to outlive the parse result
+    template<typename Parser>
+    decltype(auto) parse(Parser && p, std::string_view text)
+    {
+        return p(detail::start(text));
+    }
+
+    template<typename Parser>
+    decltype(auto) parse(Parser && p, const std::string& text)
+    {
+        return p(detail::start(text));
+    }
+
+    template<typename Parser>
+    void parse(Parser && p, std::string&& text) = delete;
+
+    // p over text with context current for the call: its scopes and state, none of the thread's
+    template<typename Parser>
+    decltype(auto) parse(Parser && p, std::string_view text, parse_context_t& context)
+    {
+        context_scope in{context};
+        return p(detail::start(text));
+    }
+
+    template<typename Parser>
+    void parse(Parser && p, std::string&& text, parse_context_t& context) = delete;
+
+    template<typename Parser>
+    decltype(auto) parse(Parser && p, const char* text)
+    {
+        return p(detail::start(std::string_view{text}));
+    }
+
+    // type-erased parser, for when a rule has to be stored or passed around opaquely
     template <typename T>
-    using parser_fun_t = std::function<parser_t<T>(std::string)>;
+    using parser_fun_t = std::function<parser_t<T>(input_t)>;
+
+    // the value type produced by parser P
+    template <typename P>
+    using value_of_t = typename decltype(parse(std::declval<const P&>(), input_t{}))::value_t;
+
+
+    /*
+     * FIRST sets: the bytes a parser can succeed on as its first one, and whether
+     * it can succeed consuming nothing. Combinators know theirs through first_set();
+     * anything else (plain functions, lambdas) may start with any byte.
+     */
+    struct first_t
+    {
+        char_class_t chars;
+        bool nullable{false};
+
+        static constexpr first_t any() { return first_t{~char_class_t{}, true}; }
+    };
+
+    namespace detail
+    {
+        template <typename P, typename = void>
+        struct has_first_set : std::false_type {};
+
+        template <typename P>
+        struct has_first_set<P, std::void_t<decltype(std::declval<const P&>().first_set())>> : std::true_type {};
+    }
+
+    template <typename P>
+    constexpr first_t first_of(const P& p)
+    {
+        if constexpr (detail::has_first_set<P>::value)
+            return p.first_set();
+        else
+            return first_t::any();
+    }
 
 
+    /*
+     * COMBINATORS
+     * every combinator is a plain struct holding its sub-parsers by value:
+     * a grammar is a single static type, nothing is built or type-erased
+     * while parsing and the whole tree can be inlined.
+     */
+
+    template<typename T>
+    struct pure_t
+    {
+        parser_t<T> operator()(input_t inp) const { return parser_t<T>(v, inp); }
+        first_t first_set() const { return first_t{{}, true}; }
+
+        T v;
+    };
+
     template<typename T>
     inline decltype(auto) pure(T v)
     {
-        return [=](std::string inp) {
-            return parser_t<T>(v, inp);
-        };
+        return pure_t<T>{std::move(v)};
     }
 
 
     template<typename P, typename F>
-    inline decltype(auto) parser_bind(P p, F f)
+    struct bind_t
     {
-        return [=](std::string inp) {
+        auto operator()(input_t inp) const
+        {
             auto a = parse(p, inp);
-            using R_T = typename decltype(parse(f(a.get()), a.remain))::value_t;
+            using R_T = value_of_t<decltype(f(std::move(a).get()))>;
 
             if (a.is_empty())
-                return empty<R_T>(a.remain);
-            return parse(f(a.get()), a.remain);
-        };
+                return empty<R_T>(a);
+            return parse(f(std::move(a).get()), a.remain);
+        }
+
+        // what follows p is only known once it ran
+        first_t first_set() const
+        {
+            const auto fp = first_of(p);
+            return fp.nullable ? first_t::any() : fp;
+        }
+
+        P p;
+        F f;
+    };
+
+    // monadic bind: f builds the next parser from the value, once per invocation
+    template<typename P, typename F>
+    inline decltype(auto) parser_bind(P p, F f)
+    {
+        return bind_t<P, F>{std::move(p), std::move(f)};
     }
 
 
-    template<typename P, typename Q>
-    inline decltype(auto) seq(P p, Q q)
+    template<typename P, typename F>
+    struct map_t
     {
-        return parser_bind(p, [q](auto x) {
-            return parser_bind(q, [=](auto y) {
-                return pure(
-                        std::tuple_cat(
-                                omega::as_tuple(x),
-                                omega::as_tuple(y)
-                        )
-                );
-            });
-        });
+        using value_t = std::decay_t<decltype(std::declval<const F&>()(std::declval<value_of_t<P>>()))>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto a = parse(p, inp);
+            if (a.is_empty())
+                return empty<value_t>(a);
+            return parser_t<value_t>{f(std::move(a).get()), a.remain};
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+        F f;
+    };
+
+    // apply f to the value of p; unlike parser_bind no parser is built per call
+    template<typename P, typename F>
+    inline decltype(auto) fmap(P p, F f)
+    {
+        return map_t<P, F>{std::move(p), std::move(f)};
     }
 
 
+    // seq(..., cut, ...): a failure after the cut commits the sequence. It adds no value to the tuple
+    struct cut_t
+    {
+        parser_t<std::tuple<>> operator()(input_t inp) const { return parser_t<std::tuple<>>{{}, inp}; }
+        first_t first_set() const { return first_t{{}, true}; }
+    };
+
+    inline constexpr cut_t cut{};
+
+
+    template<typename ...Ps>
+    struct seq_t
+    {
+        using value_t = decltype(std::tuple_cat(omega::as_tuple(std::declval<value_of_t<Ps>>())...));
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            return run<0>(inp);
+        }
+
+        first_t first_set() const
+        {
+            first_t r{{}, true};
+            // a step contributes as long as every step before it may consume nothing
+            const auto add = [&r](const first_t& f) {
+                if (!r.nullable)
+                    return;
+                r.chars = r.chars | f.chars;
+                r.nullable = f.nullable;
+            };
+            std::apply([&add](const auto& ...p) { (add(first_of(p)), ...); }, ps);
+            return r;
+        }
+
+        // whether a cut comes before step i
+        static constexpr bool past_cut(std::size_t i)
+        {
+            constexpr bool cuts[] = {std::is_same_v<Ps, cut_t>...};
+            for (std::size_t k = 0; k < i; ++k)
+                if (cuts[k])
+                    return true;
+            return false;
+        }
+
+        // each step keeps its result in its own frame: the tuple is built once at the end
+        template<std::size_t I, typename ...Vs>
+        parser_t<value_t> run(input_t inp, Vs&& ...vs) const
+        {
+            if constexpr (I == sizeof...(Ps))
+            {
+                return parser_t<value_t>{std::tuple_cat(omega::as_tuple(std::move(vs))...), inp};
+            }
+            else
+            {
+                auto a = parse(std::get<I>(ps), inp);
+                if (a.is_empty())
+                {
+                    auto r = empty<value_t>(a);
+                    r.committed = r.committed || past_cut(I);
+                    return r;
+                }
+                return run<I + 1>(a.remain, std::move(vs)..., std::move(a).get());
+            }
+        }
+
+        std::tuple<Ps...> ps;
+    };
+
     template<typename P, typename Q, typename ...Args>
     inline decltype(auto) seq(P p, Q q, Args ...args)
     {
-        return seq(p, seq(q, args...));
+        return seq_t<P, Q, Args...>{{std::move(p), std::move(q), std::move(args)...}};
     }
 
 
     template<typename P, typename Q>
-    inline decltype(auto) pipe(P p, Q q)
+    struct pipe_t
     {
-        return [=](std::string inp) {
-            const auto a = parse(p, inp);
-            if (a.is_empty())
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto a = parse(p, inp);
+            if (a.is_empty() && !a.committed)
                 return parse(q, inp);
             else
                 return a;
-        };
+        }
+
+        first_t first_set() const
+        {
+            const auto fp = first_of(p), fq = first_of(q);
+            return first_t{fp.chars | fq.chars, fp.nullable || fq.nullable};
+        }
+
+        P p;
+        Q q;
     };
 
+    template<typename P, typename Q>
+    inline decltype(auto) pipe(P p, Q q)
+    {
+        return pipe_t<P, Q>{std::move(p), std::move(q)};
+    }
+
     template<typename P, typename Q, typename ...Args>
     inline decltype(auto) pipe(P p, Q q, Args ...args)
     {
         return pipe(p, pipe(q, args...));
     }
 
+
+    template<typename P>
+    struct try_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto a = parse(p, inp);
+            a.committed = false;
+            return a;
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+    };
+
+    // p with its cuts confined to it: when p fails the enclosing pipe still tries its alternatives
+    template<typename P>
+    inline decltype(auto) try_(P p)
+    {
+        return try_t<P>{std::move(p)};
+    }
+
     /* PARSERs */
 
-    inline parser_t<char> item(std::string inp)
+    inline parser_t<char> item(input_t inp)
     {
         if (inp.empty())
-            return empty<char>();
+        {
+            expected(inp, "any character");
+            return empty<char>(inp);
+        }
         else
         {
-            return {
-                    parser_t<char>{
-                            inp[0],
-                            inp.substr(1)
-                    }
-            };
+            return parser_t<char>{inp.peek(), inp.advance(1)};
         }
     }
 
 
     template<typename F>
-    inline decltype(auto) sat(F f)
+    struct sat_t
     {
-        return [=](std::string inp) {
-            const auto x = item(inp);
-            if (!x.is_empty() && f(x.get()))
-                return x;
+        parser_t<char> operator()(input_t inp) const
+        {
+            if (!inp.empty() && f(inp.peek()))
+                return parser_t<char>{inp.peek(), inp.advance(1)};
+
+            expected(inp, what);
+            return empty<char>(inp);
+        }
+
+        first_t first_set() const
+        {
+            if constexpr (std::is_same_v<F, char_class_t>)
+                return first_t{f, false};
             else
-                return empty<decltype(x.get())>(x.remain);
-        };
+                return first_t{~char_class_t{}, false};
+        }
+
+        F f;
+        std::string_view what;
+    };
+
+    template<typename F>
+    inline decltype(auto) sat(F f, std::string_view what = "character")
+    {
+        return sat_t<F>{std::move(f), what};
     }
 
     inline decltype(auto) char_eq(char x)
     {
-        return sat([x](char ch) { return x == ch; });
+        return sat(char_class_t::of(std::string_view{&x, 1}), detail::char_label(x));
     }
 
-    inline decltype(auto) digit(std::string inp)
+    inline decltype(auto) digit(input_t inp)
     {
-        return parse(sat([](char c){ return isdigit(c); }), inp);
+        return parse(sat(classes::digit, "digit"), inp);
     }
 
-    inline decltype(auto) lower(std::string inp)
+    inline decltype(auto) lower(input_t inp)
     {
-        return parse(sat([](char c){ return islower(c); }), inp);
+        return parse(sat(classes::lower, "lowercase letter"), inp);
     }
 
-    inline decltype(auto) upper(std::string inp)
+    inline decltype(auto) upper(input_t inp)
     {
-        return parse(sat([](char c){ return isupper(c); }), inp);
+        return parse(sat(classes::upper, "uppercase letter"), inp);
     }
 
-    inline decltype(auto) letter(std::string inp)
+    inline decltype(auto) letter(input_t inp)
     {
-        return parse(sat([](char c){ return isalpha(c); }), inp);
+        return parse(sat(classes::alpha, "letter"), inp);
     }
 
-    inline decltype(auto) alphanum(std::string inp)
+    inline decltype(auto) alphanum(input_t inp)
     {
-        return parse(sat([](char c){ return isalnum(c); }), inp);
+        return parse(sat(classes::alnum, "letter or digit"), inp);
     }
 
+    struct string_eq_t
+    {
+        parser_t<std::string_view> operator()(input_t inp) const
+        {
+            const auto r = inp.rest();
+            if (r.size() < x.size()
+                || std::memcmp(r.data(), x.data(), x.size()) != 0
+                || (word && r.size() > x.size() && classes::ident_tail(r[x.size()])))
+            {
+                expected(inp, what);
+                return empty<std::string_view>(inp);
+            }
+
+            const auto last = inp.advance(x.size());
+            return parser_t<std::string_view>{inp.upto(last), last};
+        }
+
+        first_t first_set() const
+        {
+            if (x.empty())
+                return first_t{{}, true};
+            return first_t{char_class_t::of(x.substr(0, 1)), false};
+        }
+
+        std::string x;
+        std::string what;
+        bool word{false};   // x may not be followed by an identifier character
+    };
+
     inline decltype(auto) string_eq(std::string x)
     {
-        return [=](std::string inp) {
-            const auto pos = inp.find(x);
-            if (pos != 0)
-                return empty<std::string>(inp);
+        auto what = '"' + x + '"';
+        return string_eq_t{std::move(x), std::move(what)};
+    }
 
-            const auto l = x.size();
-            return parser_t<std::string>{
-                    inp.substr(0, pos + l),
-                    inp.substr(pos + l)
-            };
+    // x as a whole word: "if" does not match the start of "iffy"
+    inline decltype(auto) keyword(std::string x)
+    {
+        auto what = '"' + x + '"';
+        const bool word = !x.empty() && classes::ident_tail(x.back());
+        return string_eq_t{std::move(x), std::move(what), word};
+    }
+
+
+    template<typename P>
+    struct consumed_t
+    {
+        parser_t<std::string_view> operator()(input_t inp) const
+        {
+            const auto a = parse(p, inp);
+            if (a.is_empty())
+                return empty<std::string_view>(a);
+            return parser_t<std::string_view>{inp.upto(a.remain), a.remain};
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+    };
+
+    // the slice of input consumed by p, without building its value
+    template<typename P>
+    inline decltype(auto) consumed(P p)
+    {
+        return consumed_t<P>{std::move(p)};
+    }
+
+
+    template<typename P>
+    struct label_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            const auto f = failure_t::active();
+            if (!f)
+                return parse(p, inp);
+
+            const auto before = f->any && f->pos == inp.pos ? f->expected.size() : 0;
+            auto a = parse(p, inp);
+
+            // p got no further than inp: whatever it expected there is "what"
+            if (f->any && f->pos == inp.pos)
+            {
+                f->expected.resize(before);
+                f->expect(inp.pos, what);
+            }
+            return a;
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+        std::string_view what;
+    };
+
+    // name p in error reports, replacing the primitives it expected at its start
+    template<typename P>
+    inline decltype(auto) label(P p, std::string_view what)
+    {
+        return label_t<P>{std::move(p), what};
+    }
+
+
+    namespace detail
+    {
+        // one nesting level entered for its lifetime, left however the parse exits
+        class depth_guard_t
+        {
+        public:
+            explicit depth_guard_t(std::size_t& d) : depth(d) { ++depth; }
+            ~depth_guard_t() { --depth; }
+
+            depth_guard_t(const depth_guard_t&) = delete;
+            depth_guard_t& operator=(const depth_guard_t&) = delete;
+
+        private:
+            std::size_t& depth;
         };
     }
 
+    template<typename P>
+    struct nested_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto& context = parse_context_t::current();
+            if (context.depth >= context.depth_limit)
+            {
+                ++context.depth_cuts;
+                expected(inp, "shallower nesting");
+                auto r = empty<value_t>(inp);
+                r.committed = true;
+                return r;
+            }
+
+            const detail::depth_guard_t level{context.depth};
+            return parse(p, inp);
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+    };
 
+    /*
+     * p one nesting level deeper. Past the depth_limit of the current context it
+     * fails, committed, so a pathological input ends the parse with an error
+     * instead of overflowing the stack. A recursive grammar wraps the rules it
+     * recurses through.
+     */
     template<typename P>
-    inline decltype(auto) many(P p)
+    inline decltype(auto) nested(P p)
     {
-        return [=](std::string inp) {
-            using val_t = typename decltype(parse(p, ""))::value_t;
-            std::vector<val_t> acc;
+        return nested_t<P>{std::move(p)};
+    }
+
 
+    namespace detail
+    {
+        /*
+         * p repeated until it fails or stops consuming, each result handed to sink:
+         * the number of results and where the repetition stopped, or a committed failure
+         */
+        template<typename P, typename Sink>
+        inline parser_t<std::size_t> repeat(const P& p, input_t inp, Sink&& sink)
+        {
+            std::size_t n{};
             while (!inp.empty())
             {
                 auto a = parse(p, inp);
                 if (a.is_empty())
+                {
+                    if (a.committed)
+                        return empty<std::size_t>(a);
                     break;
+                }
 
-                acc.push_back(a.get());
-                if (inp == a.remain)
+                sink(std::move(a).get());
+                ++n;
+                if (a.remain.pos == inp.pos)
                     break;
-                else
-                    inp = a.remain;
+                inp = a.remain;
             }
+            return parser_t<std::size_t>{n, inp};
+        }
+
+        template<typename V, typename = void>
+        struct has_reserve : std::false_type {};
+
+        template<typename V>
+        struct has_reserve<V, std::void_t<decltype(std::declval<V&>().reserve(std::size_t{}))>> : std::true_type {};
 
-            return parser_t<std::vector<val_t>>{acc, inp};
+        template<typename V>
+        inline void reserve(V& acc, std::size_t hint)
+        {
+            if constexpr (has_reserve<V>::value)
+            {
+                if (hint > 0)
+                    acc.reserve(hint);
+            }
+        }
+
+        // accumulators for the fold combinators
+        struct push_back_t
+        {
+            template<typename V, typename T>
+            void operator()(V& acc, T&& x) const { acc.push_back(std::forward<T>(x)); }
         };
+
+        struct write_t
+        {
+            template<typename It, typename T>
+            void operator()(It& out, T&& x) const { *out++ = std::forward<T>(x); }
+        };
+
+        struct tally_t
+        {
+            template<typename T>
+            void operator()(std::size_t& n, T&&) const { ++n; }
+        };
+    }
+
+
+    struct take_while_t
+    {
+        parser_t<std::string_view> operator()(input_t inp) const
+        {
+            const auto n = scanner.span(inp.rest());
+            if (n < min)
+            {
+                expected(inp.advance(n), what);
+                return empty<std::string_view>(inp);
+            }
+
+            const auto last = inp.advance(n);
+            return parser_t<std::string_view>{inp.upto(last), last};
+        }
+
+        constexpr first_t first_set() const { return first_t{scanner.char_class(), min == 0}; }
+
+        char_scanner_t scanner;
+        std::size_t min;
+        std::string_view what;
+    };
+
+    // the longest run of class members, possibly empty
+    constexpr take_while_t take_while(const char_class_t& c)
+    {
+        return take_while_t{char_scanner_t{c}, 0, {}};
+    }
+
+    // as take_while, failing on an empty run
+    constexpr take_while_t take_while1(const char_class_t& c, std::string_view what = "character")
+    {
+        return take_while_t{char_scanner_t{c}, 1, what};
+    }
+
+
+    template<typename P>
+    struct many_t
+    {
+        using value_t = std::vector<value_of_t<P>>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            value_t acc;
+            detail::reserve(acc, hint);
+            const auto r = detail::repeat(p, inp, [&acc](auto&& x) { acc.push_back(std::move(x)); });
+            if (r.is_empty())
+                return empty<value_t>(r);
+            return parser_t<value_t>{std::move(acc), r.remain};
+        }
+
+        first_t first_set() const { return first_t{first_of(p).chars, true}; }
+
+        P p;
+        std::size_t hint;
+    };
+
+    // hint: the number of results to reserve room for
+    template<typename P>
+    inline decltype(auto) many(P p, std::size_t hint = 0)
+    {
+        return many_t<P>{std::move(p), hint};
     }
 
 
     template<typename P>
-    inline decltype(auto) some(P p)
+    struct some_t
     {
-        return [=](std::string inp) {
-            auto a = parse(seq(p, many(p)), inp);
-            using VT = std::remove_reference_t<decltype(std::get<1>(a.get()))>;
+        using value_t = std::vector<value_of_t<P>>;
 
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto a = parse(p, inp);
             if (a.is_empty())
-                return empty<VT>(a.remain);
-            else
+                return empty<value_t>(a);
+
+            value_t v;
+            detail::reserve(v, hint);
+            v.push_back(std::move(a).get());
+            const auto r = detail::repeat(p, a.remain, [&v](auto&& x) { v.push_back(std::move(x)); });
+            if (r.is_empty())
+                return empty<value_t>(r);
+            return parser_t<value_t>(std::move(v), r.remain);
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+        std::size_t hint;
+    };
+
+    template<typename P>
+    inline decltype(auto) some(P p, std::size_t hint = 0)
+    {
+        return some_t<P>{std::move(p), hint};
+    }
+
+
+    template<typename P, typename A, typename F>
+    struct many_fold_t
+    {
+        using value_t = A;
+
+        parser_t<A> operator()(input_t inp) const
+        {
+            A acc = init;
+            const auto r = detail::repeat(p, inp, [this, &acc](auto&& x) { f(acc, std::move(x)); });
+            if (r.is_empty())
+                return empty<A>(r);
+            return parser_t<A>{std::move(acc), r.remain};
+        }
+
+        first_t first_set() const { return first_t{first_of(p).chars, true}; }
+
+        P p;
+        A init;
+        F f;
+    };
+
+    // every result of p folded into a copy of init by f(acc, x), with no container in between
+    template<typename P, typename A, typename F>
+    inline decltype(auto) many_fold(P p, A init, F f)
+    {
+        return many_fold_t<P, A, F>{std::move(p), std::move(init), std::move(f)};
+    }
+
+    // every result of p written through out; the value is the iterator past the last write
+    template<typename P, typename It>
+    inline decltype(auto) many_to(P p, It out)
+    {
+        return many_fold(std::move(p), std::move(out), detail::write_t{});
+    }
+
+    // p as many times as it matches, counting instead of keeping the results
+    template<typename P>
+    inline decltype(auto) skip_many(P p)
+    {
+        return many_fold(std::move(p), std::size_t{0}, detail::tally_t{});
+    }
+
+
+    template<typename P>
+    struct count_t
+    {
+        using value_t = std::vector<value_of_t<P>>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            value_t acc;
+            acc.reserve(n);
+            for (std::size_t i = 0; i < n; ++i)
             {
-                VT v;
-                v.push_back(std::get<0>(a.get()));
-                auto rest = std::get<1>(a.get());
-                for (auto e : rest)
-                    v.push_back(e);
-                return parser_t<VT>(v, a.remain);
+                auto a = parse(p, inp);
+                if (a.is_empty())
+                    return empty<value_t>(a);
+
+                acc.push_back(std::move(a).get());
+                inp = a.remain;
             }
-        };
+            return parser_t<value_t>{std::move(acc), inp};
+        }
+
+        first_t first_set() const { return n == 0 ? first_t{{}, true} : first_of(p); }
+
+        std::size_t n;
+        P p;
+    };
+
+    // exactly n results of p
+    template<typename P>
+    inline decltype(auto) count(std::size_t n, P p)
+    {
+        return count_t<P>{n, std::move(p)};
     }
 
 
-    inline parser_t<std::string> ident(std::string inp)
+    inline parser_t<std::string_view> ident(input_t inp)
     {
-        return parse(
-                parser_bind(
-                        seq(lower, many(pipe(alphanum, sat([](char c) { return c == '_'; })))),
-                        [](auto x) {
-                            const auto& v_rest = std::get<1>(x);
-                            std::string rest = std::accumulate(std::begin(v_rest), std::end(v_rest), std::string{}, [](auto c, auto acc) { return c + acc; });
-                            return pure(std::string{std::get<0>(x)} + rest);
-                        }
-                ),
-                inp
-        );
+        static constexpr auto tail = take_while(classes::ident_tail);
+        if (inp.empty() || !classes::lower(inp.peek()))
+        {
+            expected(inp, "identifier");
+            return empty<std::string_view>(inp);
+        }
+
+        const auto last = tail(inp.advance(1)).remain;
+        return parser_t<std::string_view>{inp.upto(last), last};
     }
 
 
-    inline decltype(auto) space(std::string inp)
+    inline parser_t<std::string_view> space(input_t inp)
     {
-        return parse(
-                parser_bind(
-                        many(sat([](char c) { return isspace(c); })),
-                        [](auto x) {
-                            return pure(std::string(x.size(), ' '));
-                        }
-                ),
-                inp
-        );
+        static constexpr auto p = take_while(classes::space);
+        return p(inp);
     }
 
-    inline decltype(auto) space1(std::string inp)
+    inline decltype(auto) space1(input_t inp)
     {
         return parse(
                 seq(
-                    sat([](char c) { return isspace(c); }),
+                    sat(classes::space, "space"),
                     space
                 ),
                 inp
@@ -315,51 +945,64 @@ namespace lparser
 
 
     template<typename P>
-    inline decltype(auto) token(P p)
+    struct token_t
     {
-        return [=](std::string inp) {
-            using p_t = decltype(parse(p, inp));
-            using value_t = typename p_t::value_t;
-
-            value_t value;
-            const auto r = parse(
-                    seq(
-                            space,
-                            parser_bind(p, [&value](auto v) {
-                                value = v;
-                                return pure(v);
-                            }),
-                            space
-                    ), inp
-            );
+        using value_t = value_of_t<P>;
 
-            if (r.is_empty())
-                return empty<value_t>(r.remain);
-            else
-                return parser_t<value_t>{value, r.remain};
-        };
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto v = parse(p, space(inp).remain);
+            if (v.is_empty())
+                return empty<value_t>(v);
+
+            const auto last = space(v.remain).remain;
+            return parser_t<value_t>{std::move(v).get(), last};
+        }
+
+        first_t first_set() const
+        {
+            const auto fp = first_of(p);
+            return first_t{classes::space | fp.chars, fp.nullable};
+        }
+
+        P p;
+    };
+
+    template<typename P>
+    inline decltype(auto) token(P p)
+    {
+        return token_t<P>{std::move(p)};
     }
 
 
-    inline parser_t<long> nat(std::string inp)
+    inline parser_t<long> nat(input_t inp)
     {
-        const auto r = parse(some(digit), inp);
+        static constexpr auto digits = take_while1(classes::digit, "digit");
+        const auto r = digits(inp);
         if (r.is_empty())
             return empty<long>(r.remain);
 
-        auto v = r.get();
-        long n{}, s = v.size() - 1;
-        for(unsigned char x : v)
+        // a literal out of the range of long is an error, not a shorter nat
+        constexpr auto max = std::numeric_limits<long>::max();
+        long n{};
+        for (const char x : r.get())
         {
-            const auto d = (unsigned int)(x - '0');
-            n += std::pow(10, s--) * d;
+            const long d = x - '0';
+            if (n > (max - d) / 10)
+            {
+                expected(inp, "number in range");
+                auto e = empty<long>(inp);
+                e.committed = true;
+                return e;
+            }
+            n = n * 10 + d;
         }
 
         return parser_t<long>{n, r.remain};
     }
 
 
-    inline decltype(auto) intg(std::string inp)
+    inline decltype(auto) intg(input_t inp)
     {
         return parse(pipe(
                 nat,
@@ -370,27 +1013,21 @@ namespace lparser
         ), inp);
     }
 
-    inline decltype(auto) integer(std::string inp)
+    inline decltype(auto) integer(input_t inp)
     {
         return parse(token(intg), inp);
     }
 
-    inline decltype(auto) natural(std::string inp)
+    inline decltype(auto) natural(input_t inp)
     {
         return parse(token(nat), inp);
     }
 
-    inline decltype(auto) string(std::string inp)
+    inline decltype(auto) string(input_t inp)
     {
         return parse(
                 parser_bind(token(seq(char_eq('"'),
-                               parser_bind(many(alphanum), [](const std::vector<char>& vs){
-                                   std::string s;
-                                   s.reserve(vs.size());
-                                   for (auto ch : vs)
-                                       s += ch;
-                                   return pure(s);
-                               }),
+                               take_while(classes::alnum),
                                char_eq('"'))),
                             [](const auto& x){
                                 return pure(std::get<1>(x));
@@ -400,21 +1037,35 @@ namespace lparser
 
     inline decltype(auto) symbol(std::string x)
     {
-        return [=](std::string inp) {
-            std::string s;
-            auto r = parse(
-                    parser_bind(seq(space, string_eq(x), space), [&s](auto x){
-                        s = std::get<1>(x);
-                        return pure(1);
-                    }),
-                    inp
-            );
-
-            if(r.is_empty())
-                return empty<std::string>(r.remain);
-            else
-                return parser_t<std::string>(s, r.remain);
-        };
+        return token(string_eq(std::move(x)));
+    }
+
+
+    /* ERROR REPORTING */
+
+    // p applied to the whole text: a result with input left over is a failure
+    template<typename Parser>
+    inline decltype(auto) parse_all(Parser&& p, std::string_view text)
+    {
+        auto r = parse(p, detail::start(text));
+        if (!r.is_empty() && !r.remain.empty())
+        {
+            expected(r.remain, "end of input");
+            return empty<typename decltype(r)::value_t>(r);
+        }
+        return r;
+    }
+
+    // re-runs a failed parse_all recording failures: valid inputs never pay for it
+    template<typename Parser>
+    inline parse_error_t diagnose(Parser&& p, std::string_view text)
+    {
+        failure_t f;
+        {
+            failure_scope scope{f};
+            parse_all(p, text);
+        }
+        return detail::make_error(text, f);
     }
 }
 
@@ -6,98 +6,376 @@
 #define PARSER_LPARSER_BRICKS_HPP_H
 
 #include "lparser.hpp"
+#include "lparser_choice.hpp"
+#include <algorithm>
+#include <type_traits>
+#include <vector>
 
 
 namespace lparser
 {
+    /*
+     * p separated by sep. A separator not followed by p is left in the input,
+     * unless trailing separators are allowed (sep_end_by).
+     */
+    template <typename P, typename S, typename A, typename F>
+    struct sep_by_t
+    {
+        using value_t = A;
+
+        parser_t<A> operator()(input_t inp) const
+        {
+            A acc = init;
+            detail::reserve(acc, hint);
+
+            auto a = parse(p, inp);
+            if (a.is_empty())
+            {
+                if (min == 0 && !a.committed)
+                    return parser_t<A>{std::move(acc), inp};
+                return empty<A>(a);
+            }
+
+            f(acc, std::move(a).get());
+            inp = a.remain;
+            while (true)
+            {
+                const auto s = parse(sep, inp);
+                if (s.is_empty())
+                {
+                    if (s.committed)
+                        return empty<A>(s);
+                    break;
+                }
+
+                auto b = parse(p, s.remain);
+                if (b.is_empty())
+                {
+                    if (b.committed)
+                        return empty<A>(b);
+                    if (trailing)
+                        inp = s.remain;
+                    break;
+                }
+
+                f(acc, std::move(b).get());
+                if (b.remain.pos == inp.pos)
+                    break;
+                inp = b.remain;
+            }
+            return parser_t<A>{std::move(acc), inp};
+        }
+
+        first_t first_set() const
+        {
+            const auto fp = first_of(p);
+            return first_t{fp.chars, fp.nullable || min == 0};
+        }
+
+        P p;
+        S sep;
+        A init;
+        F f;
+        std::size_t min;
+        bool trailing;
+        std::size_t hint;
+    };
+
+    template <typename P, typename S>
+    using sep_by_vector_t = sep_by_t<P, S, std::vector<value_of_t<P>>, detail::push_back_t>;
+
+    // zero or more p separated by sep; hint: the number of results to reserve room for
+    template <typename P, typename S>
+    inline decltype(auto) sep_by(P p, S sep, std::size_t hint = 0)
+    {
+        return sep_by_vector_t<P, S>{std::move(p), std::move(sep), {}, {}, 0, false, hint};
+    }
+
+    // one or more p separated by sep
+    template <typename P, typename S>
+    inline decltype(auto) sep_by1(P p, S sep, std::size_t hint = 0)
+    {
+        return sep_by_vector_t<P, S>{std::move(p), std::move(sep), {}, {}, 1, false, hint};
+    }
+
+    // zero or more p separated, and optionally ended, by sep
+    template <typename P, typename S>
+    inline decltype(auto) sep_end_by(P p, S sep, std::size_t hint = 0)
+    {
+        return sep_by_vector_t<P, S>{std::move(p), std::move(sep), {}, {}, 0, true, hint};
+    }
+
+    // zero or more p separated by sep, folded into a copy of init by f(acc, x)
+    template <typename P, typename S, typename A, typename F>
+    inline decltype(auto) sep_by_fold(P p, S sep, A init, F f)
+    {
+        return sep_by_t<P, S, A, F>{std::move(p), std::move(sep), std::move(init), std::move(f), 0, false, 0};
+    }
+
+
     template <typename T>
     inline decltype(auto) lists(T parser)
     {
-        using RT = typename decltype(parse(parser, ""))::value_t;
-
-        return [=](std::string inp){
-            std::vector<RT> vs;
-            auto extract = [&vs](RT x) {
-                vs.push_back(x);
-                return pure(x);
-            };
-
-            const auto r = parse(
-                    seq(
-                            symbol("["),
-                            parser_bind(parser, extract),
-                            many(seq(symbol(","), parser_bind(parser, extract))),
-                            symbol("]")
-                    ),
-                    inp
-            );
-
-            if (r.is_empty())
-                return empty<std::vector<RT>>();
-            else
-                return parser_t<std::vector<RT>>{vs, r.remain};
-        };
+        return fmap(
+                seq(symbol("["), sep_by1(std::move(parser), symbol(",")), symbol("]")),
+                [](auto x) { return std::get<1>(std::move(x)); }
+        );
     }
 
     template <typename T>
     inline decltype(auto) params(T parser)
     {
-        using RT = typename decltype(parse(parser, ""))::value_t;
-
-        return [=](std::string inp){
-            std::vector<RT> vs;
-            auto extract = [&vs](const RT& x) {
-                vs.push_back(x);
-                return pure(1);
-            };
-
-            const auto r = parse(
-                    seq(
-                        parser_bind(parser, extract),
-                        many(seq(space, char_eq(','), space, parser_bind(parser, extract)))
-                    ),
-                    inp
-            );
-
-            if (r.is_empty())
-                return empty<std::vector<RT>>(r.remain);
-            else
-                return parser_t<std::vector<RT>>{vs, r.remain};
-        };
+        return sep_by1(std::move(parser), seq(space, char_eq(','), space));
     }
 
-    inline decltype(auto) nats(std::string inp)
+    inline decltype(auto) nats(input_t inp)
+    {
+        static const auto p = lists(natural);
+        return parse(p, inp);
+    }
+
+
+    inline decltype(auto) strings(input_t inp)
+    {
+        static const auto p = lists(alphanum);
+        return parse(p, inp);
+    }
+
+
+    inline decltype(auto) assign(input_t inp)
+    {
+        static const auto p = fmap(
+                seq(ident, space, char_eq('='), space, ident),
+                [](auto x) {
+                    return std::make_pair(std::get<0>(x), std::get<4>(x));
+                }
+        );
+
+        return parse(p, inp);
+    }
+
+
+    /* operator chains: op yields a binary callable combining two p results */
+
+    template <typename P, typename Op>
+    struct chainl1_t
     {
-        return parse(lists(natural), inp);
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            auto a = parse(p, inp);
+            if (a.is_empty())
+                return empty<value_t>(a);
+
+            value_t acc = std::move(a).get();
+            inp = a.remain;
+            while (true)
+            {
+                auto f = parse(op, inp);
+                if (f.is_empty())
+                {
+                    if (f.committed)
+                        return empty<value_t>(f);
+                    break;
+                }
+
+                auto b = parse(p, f.remain);
+                if (b.is_empty())
+                {
+                    if (b.committed)
+                        return empty<value_t>(b);
+                    break;
+                }
+
+                acc = f.get()(std::move(acc), std::move(b).get());
+                inp = b.remain;
+            }
+
+            return parser_t<value_t>{std::move(acc), inp};
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+        Op op;
+    };
+
+    // p (op p)*, combined from the left
+    template <typename P, typename Op>
+    inline decltype(auto) chainl1(P p, Op op)
+    {
+        return chainl1_t<P, Op>{std::move(p), std::move(op)};
     }
 
+    template <typename P, typename Op>
+    struct chainr1_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            using F = value_of_t<Op>;
+
+            auto a = parse(p, inp);
+            if (a.is_empty())
+                return empty<value_t>(a);
+
+            std::vector<value_t> xs;
+            std::vector<F> fs;
+            xs.push_back(std::move(a).get());
+            inp = a.remain;
+            while (true)
+            {
+                auto f = parse(op, inp);
+                if (f.is_empty())
+                {
+                    if (f.committed)
+                        return empty<value_t>(f);
+                    break;
+                }
+
+                auto b = parse(p, f.remain);
+                if (b.is_empty())
+                {
+                    if (b.committed)
+                        return empty<value_t>(b);
+                    break;
+                }
+
+                fs.push_back(std::move(f).get());
+                xs.push_back(std::move(b).get());
+                inp = b.remain;
+            }
+
+            value_t acc = std::move(xs.back());
+            for (auto i = fs.size(); i-- > 0; )
+                acc = fs[i](std::move(xs[i]), std::move(acc));
+
+            return parser_t<value_t>{std::move(acc), inp};
+        }
+
+        first_t first_set() const { return first_of(p); }
 
-    inline decltype(auto) strings(std::string inp)
+        P p;
+        Op op;
+    };
+
+    // p (op p)*, combined from the right
+    template <typename P, typename Op>
+    inline decltype(auto) chainr1(P p, Op op)
     {
-        return parse(lists(alphanum), inp);
+        return chainr1_t<P, Op>{std::move(p), std::move(op)};
     }
 
 
-    inline decltype(auto) assign(std::string inp)
+    /* precedence climbing over a table of binary operators */
+
+    enum class assoc_t { left, right };
+
+    struct operator_def_t
     {
-        std::string name, value;
+        std::string token;
+        int precedence;
+        assoc_t assoc;
+    };
+
+    namespace detail
+    {
+        template <typename P, typename F>
+        struct precedence_parser_t
+        {
+            using T = typename decltype(parse(std::declval<P>(), input_t{}))::value_t;
+
+            // longest operator token starting at inp, if any
+            const operator_def_t* match(const input_t& inp) const
+            {
+                const auto m = tokens.match(inp.rest());
+                return m.word == literal_trie_t::none ? nullptr : &ops[m.word];
+            }
+
+            parser_t<T> climb(input_t inp, int min_precedence) const
+            {
+                auto a = parse(operand, inp);
+                if (a.is_empty())
+                    return a;
+
+                T lhs = std::move(a).get();
+                inp = a.remain;
+                while (true)
+                {
+                    const auto op = match(inp);
+                    if (op == nullptr)
+                    {
+                        expected(inp, "operator");
+                        break;
+                    }
+                    if (op->precedence < min_precedence)
+                        break;
+
+                    const auto next = op->assoc == assoc_t::left ? op->precedence + 1 : op->precedence;
+                    auto b = climb(inp.advance(op->token.size()), next);
+                    if (b.is_empty())
+                    {
+                        if (b.committed)
+                            return b;
+                        break;
+                    }
+
+                    lhs = apply(*op, std::move(lhs), std::move(b).get());
+                    inp = b.remain;
+                }
 
-        const auto r = parse(seq(
-                parser_bind(ident, [&](std::string x){name = x; return pure(x);}),
-                space,
-                char_eq('='),
-                space,
-                parser_bind(ident, [&](std::string x){value = x; return pure(x);})
-        ), inp);
+                return parser_t<T>{std::move(lhs), inp};
+            }
 
-        if (r.is_empty())
-            return empty<std::pair<std::string, std::string>>();
-        else
+            parser_t<T> operator()(input_t inp) const
+            {
+                return climb(inp, min_level);
+            }
+
+            first_t first_set() const { return first_of(operand); }
+
+            T apply(const operator_def_t& op, T lhs, T rhs) const
+            {
+                if constexpr (std::is_invocable_v<const F&, std::size_t, T, T>)
+                    return combine(static_cast<std::size_t>(&op - ops.data()), std::move(lhs), std::move(rhs));
+                else
+                    return combine(std::string_view{op.token}, std::move(lhs), std::move(rhs));
+            }
+
+            P operand;
+            std::vector<operator_def_t> ops;
+            keyword_set_t tokens;
+            F combine;
+            int min_level;
+        };
+    }
+
+    /*
+     * each operand is parsed exactly once; combine(token, lhs, rhs) builds the node,
+     * or combine(index, lhs, rhs) with the operator's position in ops when it takes one.
+     * Word operators ("in") only match as whole words. An operator whose right
+     * operand does not parse is left in the input.
+     */
+    template <typename P, typename F>
+    inline decltype(auto) expression(P operand, std::vector<operator_def_t> ops, F combine)
+    {
+        std::vector<std::string> tokens;
+        for (const auto& op : ops)
+            tokens.push_back(op.token);
+
+        int min_level{};
+        if (!ops.empty())
         {
-            return parser_t<std::pair<std::string, std::string>>{
-                    {name, value}, r.remain
-            };
+            min_level = std::min_element(ops.begin(), ops.end(), [](const auto& a, const auto& b) {
+                return a.precedence < b.precedence;
+            })->precedence;
         }
+
+        return detail::precedence_parser_t<P, F>{
+                std::move(operand), std::move(ops), keyword_set_t{std::move(tokens)}, std::move(combine), min_level
+        };
     }
 }
 
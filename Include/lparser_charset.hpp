@@ -0,0 +1,204 @@
+//
+// Character classes and span scanners
+//
+
+#ifndef PARSER_LPARSER_CHARSET_HPP_H
+#define PARSER_LPARSER_CHARSET_HPP_H
+
+#include <cstdint>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+namespace lparser
+{
+    /* a set of bytes as a 256 bit map, composable at compile time */
+
+    struct char_class_t
+    {
+        static constexpr char_class_t range(char lo, char hi)
+        {
+            char_class_t c;
+            for (unsigned u = static_cast<unsigned char>(lo); u <= static_cast<unsigned char>(hi); u++)
+                c.bits[u >> 6] |= std::uint64_t{1} << (u & 63);
+            return c;
+        }
+
+        static constexpr char_class_t of(std::string_view chars)
+        {
+            char_class_t c;
+            for (const char ch : chars)
+            {
+                const auto u = static_cast<unsigned char>(ch);
+                c.bits[u >> 6] |= std::uint64_t{1} << (u & 63);
+            }
+            return c;
+        }
+
+        constexpr bool contains(char ch) const
+        {
+            const auto u = static_cast<unsigned char>(ch);
+            return (bits[u >> 6] >> (u & 63)) & 1;
+        }
+
+        constexpr bool operator()(char ch) const { return contains(ch); }
+
+        constexpr char_class_t operator|(const char_class_t& rhs) const
+        {
+            char_class_t c;
+            for (int i = 0; i < 4; i++)
+                c.bits[i] = bits[i] | rhs.bits[i];
+            return c;
+        }
+
+        constexpr char_class_t operator&(const char_class_t& rhs) const
+        {
+            char_class_t c;
+            for (int i = 0; i < 4; i++)
+                c.bits[i] = bits[i] & rhs.bits[i];
+            return c;
+        }
+
+        constexpr char_class_t operator~() const
+        {
+            char_class_t c;
+            for (int i = 0; i < 4; i++)
+                c.bits[i] = ~bits[i];
+            return c;
+        }
+
+        std::uint64_t bits[4]{};
+    };
+
+
+    namespace classes
+    {
+        inline constexpr auto digit = char_class_t::range('0', '9');
+        inline constexpr auto lower = char_class_t::range('a', 'z');
+        inline constexpr auto upper = char_class_t::range('A', 'Z');
+        inline constexpr auto alpha = lower | upper;
+        inline constexpr auto alnum = alpha | digit;
+        inline constexpr auto xdigit = digit | char_class_t::range('a', 'f') | char_class_t::range('A', 'F');
+        inline constexpr auto space = char_class_t::of(" \t\n\v\f\r");
+        inline constexpr auto ident_tail = alnum | char_class_t::of("_");
+    }
+
+
+    /*
+     * counts the leading members of a class in a string.
+     * With AVX2 an ASCII-only class is looked up 32 bytes at a time through two
+     * nibble tables; with SSE2 a class made of at most 4 byte ranges is tested
+     * 16 bytes at a time; anything else, and the tail, goes through the bitmap.
+     */
+    class char_scanner_t
+    {
+    public:
+        constexpr explicit char_scanner_t(const char_class_t& c)
+        : cls(c)
+        {
+            for (unsigned u = 0; u < 256; u++)
+            {
+                if (!cls.contains(static_cast<char>(u)))
+                    continue;
+
+                if (u >= 0x80)
+                    ascii = false;
+                else
+                    nibble_lo[u & 0x0F] |= static_cast<std::uint8_t>(1u << (u >> 4));
+
+                if (n_ranges >= 0 && (u == 0 || !cls.contains(static_cast<char>(u - 1))))
+                {
+                    if (n_ranges == max_ranges)
+                        n_ranges = -1;
+                    else
+                        range_lo[n_ranges++] = static_cast<std::uint8_t>(u);
+                }
+                if (n_ranges > 0)
+                    range_hi[n_ranges - 1] = static_cast<std::uint8_t>(u);
+            }
+
+            for (unsigned h = 0; h < 8; h++)
+                nibble_hi[h] = static_cast<std::uint8_t>(1u << h);
+        }
+
+        constexpr const char_class_t& char_class() const { return cls; }
+
+        std::size_t span(std::string_view s) const
+        {
+            const char* const first = s.data();
+            const char* const last = first + s.size();
+            const char* it = first;
+
+#if defined(__AVX2__)
+            if (ascii)
+            {
+                const auto lo_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_lo)));
+                const auto hi_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_hi)));
+                const auto low4 = _mm256_set1_epi8(0x0F);
+                const auto zero = _mm256_setzero_si256();
+
+                for (; last - it >= 32; it += 32)
+                {
+                    const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+                    const auto lo = _mm256_and_si256(x, low4);
+                    const auto hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low4);
+                    const auto hit = _mm256_and_si256(_mm256_shuffle_epi8(lo_tbl, lo), _mm256_shuffle_epi8(hi_tbl, hi));
+                    const auto miss = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, zero)));
+                    if (miss != 0)
+                        return static_cast<std::size_t>(it - first) + __builtin_ctz(miss);
+                }
+            }
+            else
+#endif
+#if defined(__SSE2__)
+            if (n_ranges > 0)
+            {
+                __m128i base[max_ranges], limit[max_ranges];
+                const auto flip = _mm_set1_epi8(static_cast<char>(0x80));
+                for (int r = 0; r < n_ranges; r++)
+                {
+                    base[r] = _mm_set1_epi8(static_cast<char>(range_lo[r]));
+                    limit[r] = _mm_set1_epi8(static_cast<char>((range_hi[r] - range_lo[r]) ^ 0x80));
+                }
+
+                for (; last - it >= 16; it += 16)
+                {
+                    const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+
+                    // x in [lo, hi]  <=>  unsigned(x - lo) <= hi - lo; out marks the bytes outside every range
+                    auto out = _mm_set1_epi8(-1);
+                    for (int r = 0; r < n_ranges; r++)
+                    {
+                        const auto d = _mm_xor_si128(_mm_sub_epi8(x, base[r]), flip);
+                        out = _mm_and_si128(out, _mm_cmpgt_epi8(d, limit[r]));
+                    }
+
+                    const auto miss = static_cast<std::uint32_t>(_mm_movemask_epi8(out));
+                    if (miss != 0)
+                        return static_cast<std::size_t>(it - first) + __builtin_ctz(miss);
+                }
+            }
+#endif
+
+            while (it != last && cls.contains(*it))
+                ++it;
+            return static_cast<std::size_t>(it - first);
+        }
+
+    private:
+        static constexpr int max_ranges = 4;
+
+        char_class_t cls;
+        bool ascii{true};
+        std::uint8_t nibble_lo[16]{};
+        std::uint8_t nibble_hi[16]{};
+        int n_ranges{};
+        std::uint8_t range_lo[max_ranges]{};
+        std::uint8_t range_hi[max_ranges]{};
+    };
+}
+
+#endif //PARSER_LPARSER_CHARSET_HPP_H
@@ -0,0 +1,356 @@
+//
+// Alternatives dispatched on the next byte, and longest-match literal sets
+//
+
+#ifndef PARSER_LPARSER_CHOICE_HPP_H
+#define PARSER_LPARSER_CHOICE_HPP_H
+
+#include "lparser.hpp"
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace lparser
+{
+    template<typename P>
+    struct starts_with_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const { return parse(p, inp); }
+        first_t first_set() const { return first; }
+
+        first_t first;
+        P p;
+    };
+
+    // p declared to start with a byte of chars: for rules choice() cannot look into
+    template<typename P>
+    inline decltype(auto) starts_with(const char_class_t& chars, P p)
+    {
+        return starts_with_t<P>{first_t{chars, false}, std::move(p)};
+    }
+
+
+    namespace detail
+    {
+        template<std::size_t N>
+        using alternative_mask_t =
+            std::conditional_t<(N <= 8), std::uint8_t,
+            std::conditional_t<(N <= 16), std::uint16_t,
+            std::conditional_t<(N <= 32), std::uint32_t, std::uint64_t>>>;
+    }
+
+    /*
+     * pipe() over many alternatives, trying only those whose FIRST set holds the
+     * next byte (nullable ones are tried anywhere, and the only ones at the end of
+     * input). Alternatives keep their order, so a success is the one pipe() gives;
+     * a failure is the one of the last alternative tried.
+     */
+    template<typename ...Ps>
+    class choice_t
+    {
+        static_assert(sizeof...(Ps) <= 64, "choice_t takes at most 64 alternatives");
+        using mask_t = detail::alternative_mask_t<sizeof...(Ps)>;
+
+    public:
+        using value_t = value_of_t<std::tuple_element_t<0, std::tuple<Ps...>>>;
+
+        explicit choice_t(Ps... alternatives)
+        : ps(std::move(alternatives)...)
+        {
+            std::size_t i{};
+            std::apply([&](const auto& ...p) { (add(i++, first_of(p)), ...); }, ps);
+        }
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            // a report has to see every alternative fail
+            if (diagnosing())
+                return run<0>(inp, static_cast<mask_t>(~mask_t{}));
+
+            return run<0>(inp, inp.empty() ? at_end : table[static_cast<unsigned char>(inp.peek())]);
+        }
+
+        first_t first_set() const
+        {
+            first_t r{{}, at_end != 0};
+            for (unsigned c = 0; c < 256; ++c)
+                if (table[c] != 0)
+                    r.chars.bits[c >> 6] |= std::uint64_t{1} << (c & 63);
+            return r;
+        }
+
+    private:
+        void add(std::size_t i, const first_t& f)
+        {
+            const auto bit = static_cast<mask_t>(mask_t{1} << i);
+            for (int c = 0; c < 256; ++c)
+                if (f.nullable || f.chars.contains(static_cast<char>(c)))
+                    table[c] |= bit;
+            if (f.nullable)
+                at_end |= bit;
+        }
+
+        template<std::size_t I>
+        parser_t<value_t> run(input_t inp, mask_t candidates) const
+        {
+            if constexpr (I == sizeof...(Ps))
+            {
+                return empty<value_t>(inp);
+            }
+            else
+            {
+                if (candidates & (mask_t{1} << I))
+                {
+                    auto a = parse(std::get<I>(ps), inp);
+                    if (!a.is_empty() || a.committed || (candidates >> I) == 1)
+                        return a;
+                }
+                return run<I + 1>(inp, candidates);
+            }
+        }
+
+        std::tuple<Ps...> ps;
+        std::array<mask_t, 256> table{};
+        mask_t at_end{};
+    };
+
+    template<typename P, typename ...Ps>
+    inline decltype(auto) choice(P p, Ps ...ps)
+    {
+        return choice_t<P, Ps...>{std::move(p), std::move(ps)...};
+    }
+
+
+    /*
+     * a set of literals compiled into a trie: the longest one prefixing the input
+     * is found in a single pass, so ">=" is never shadowed by ">"
+     */
+    class literal_trie_t
+    {
+    public:
+        static constexpr int none = -1;
+
+        literal_trie_t() = default;
+
+        // the index of a literal is its position in words; a repeated word keeps the first
+        explicit literal_trie_t(const std::vector<std::string>& words)
+        {
+            struct build_t
+            {
+                int word{none};
+                std::map<unsigned char, std::size_t> next;
+            };
+
+            std::vector<build_t> tree(1);
+            for (std::size_t w = 0; w < words.size(); ++w)
+            {
+                std::size_t n{};
+                for (const char ch : words[w])
+                {
+                    const auto c = static_cast<unsigned char>(ch);
+                    auto it = tree[n].next.find(c);
+                    if (it == tree[n].next.end())
+                    {
+                        it = tree[n].next.emplace(c, tree.size()).first;
+                        tree.emplace_back();
+                    }
+                    n = it->second;
+                }
+                if (tree[n].word == none)
+                    tree[n].word = static_cast<int>(w);
+            }
+
+            // flattened: the edges of a node are contiguous and sorted by byte
+            nodes.resize(tree.size());
+            for (std::size_t n = 0; n < tree.size(); ++n)
+            {
+                nodes[n].word = tree[n].word;
+                nodes[n].first_edge = static_cast<std::uint32_t>(edges.size());
+                for (const auto& e : tree[n].next)
+                    edges.push_back(edge_t{e.first, static_cast<std::uint32_t>(e.second)});
+                nodes[n].last_edge = static_cast<std::uint32_t>(edges.size());
+            }
+
+            for (const auto& e : tree[0].next)
+                first.bits[e.first >> 6] |= std::uint64_t{1} << (e.first & 63);
+            empty_word = tree[0].word;
+        }
+
+        struct match_t
+        {
+            int word{none};
+            std::size_t length{};
+        };
+
+        match_t longest(std::string_view s) const
+        {
+            return longest_if(s, [](std::size_t) { return true; });
+        }
+
+        // the longest literal at the start of s whose length accept(length) allows
+        template<typename F>
+        match_t longest_if(std::string_view s, F accept) const
+        {
+            match_t m;
+            if (empty_word != none && accept(std::size_t{0}))
+                m = match_t{empty_word, 0};
+            if (s.empty() || !first.contains(s[0]))
+                return m;
+
+            std::size_t n{};
+            for (std::size_t i = 0; i < s.size(); ++i)
+            {
+                const auto c = static_cast<unsigned char>(s[i]);
+                const edge_t* e = edges.data() + nodes[n].first_edge;
+                const edge_t* last = edges.data() + nodes[n].last_edge;
+                while (e != last && e->byte < c)
+                    ++e;
+                if (e == last || e->byte != c)
+                    break;
+
+                n = e->target;
+                if (nodes[n].word != none && accept(i + 1))
+                    m = match_t{nodes[n].word, i + 1};
+            }
+            return m;
+        }
+
+        // the bytes a non-empty literal starts with
+        const char_class_t& first_bytes() const { return first; }
+        bool has_empty() const { return empty_word != none; }
+
+    private:
+        struct node_t
+        {
+            int word{none};
+            std::uint32_t first_edge{}, last_edge{};
+        };
+
+        struct edge_t
+        {
+            unsigned char byte;
+            std::uint32_t target;
+        };
+
+        std::vector<node_t> nodes{1};
+        std::vector<edge_t> edges;
+        char_class_t first;
+        int empty_word{none};
+    };
+
+
+    /*
+     * a fixed vocabulary matched longest first. A word's id is its position in
+     * the list, so ids can index tables; a word ending in an identifier character
+     * only matches as a whole word.
+     */
+    class keyword_set_t
+    {
+    public:
+        keyword_set_t() = default;
+
+        explicit keyword_set_t(std::vector<std::string> ws)
+        : trie(ws), words(std::move(ws))
+        {}
+
+        // the longest word at the start of s that ends on a word boundary: "in" in "in x" but not in "inx"
+        literal_trie_t::match_t match(std::string_view s) const
+        {
+            return trie.longest_if(s, [s](std::size_t n) {
+                return n == 0 || n == s.size() || !classes::ident_tail(s[n - 1]) || !classes::ident_tail(s[n]);
+            });
+        }
+
+        const std::string& name(int id) const { return words[id]; }
+        std::size_t size() const { return words.size(); }
+        const literal_trie_t& literals() const { return trie; }
+
+    private:
+        literal_trie_t trie;
+        std::vector<std::string> words;
+    };
+
+
+    namespace detail
+    {
+        // "a", "b" or "c"
+        inline std::string quoted_list(const std::vector<std::string>& words)
+        {
+            std::string what;
+            for (std::size_t i = 0; i < words.size(); ++i)
+            {
+                if (i > 0)
+                    what += i + 1 == words.size() ? " or " : ", ";
+                what += '"' + words[i] + '"';
+            }
+            return what;
+        }
+    }
+
+
+    struct one_of_t
+    {
+        parser_t<std::string_view> operator()(input_t inp) const
+        {
+            const auto m = trie.longest(inp.rest());
+            if (m.word == literal_trie_t::none)
+            {
+                expected(inp, what);
+                return empty<std::string_view>(inp);
+            }
+
+            const auto last = inp.advance(m.length);
+            return parser_t<std::string_view>{inp.upto(last), last};
+        }
+
+        first_t first_set() const { return first_t{trie.first_bytes(), trie.has_empty()}; }
+
+        literal_trie_t trie;
+        std::string what;
+    };
+
+    // the longest of the literals found at the input
+    inline decltype(auto) one_of(std::initializer_list<std::string> literals)
+    {
+        std::vector<std::string> words{literals};
+        auto what = detail::quoted_list(words);
+        return one_of_t{literal_trie_t{words}, std::move(what)};
+    }
+
+
+    struct keywords_t
+    {
+        parser_t<int> operator()(input_t inp) const
+        {
+            const auto m = set.match(inp.rest());
+            if (m.word == literal_trie_t::none)
+            {
+                expected(inp, what);
+                return empty<int>(inp);
+            }
+            return parser_t<int>{m.word, inp.advance(m.length)};
+        }
+
+        first_t first_set() const { return first_t{set.literals().first_bytes(), set.literals().has_empty()}; }
+
+        keyword_set_t set;
+        std::string what;
+    };
+
+    // the id (position in the list) of the longest keyword found at the input
+    inline decltype(auto) keywords(std::initializer_list<std::string> words)
+    {
+        std::vector<std::string> ws{words};
+        auto what = detail::quoted_list(ws);
+        return keywords_t{keyword_set_t{std::move(ws)}, std::move(what)};
+    }
+}
+
+#endif //PARSER_LPARSER_CHOICE_HPP_H
@@ -0,0 +1,147 @@
+//
+// The mutable state of a parse, gathered in one context object
+//
+
+#ifndef PARSER_LPARSER_CONTEXT_HPP_H
+#define PARSER_LPARSER_CONTEXT_HPP_H
+
+#include <cstddef>
+#include <cstdlib>
+
+
+namespace lparser
+{
+    struct failure_t;
+
+    /*
+     * everything a parse writes besides its result: the failure record, the
+     * memo tables, and a slot per type for what rules build into or read from
+     * (an ast, a token stream). Parser objects hold no mutable state: a grammar
+     * is built once and can be shared by any number of threads, as long as
+     * concurrent parses run in distinct contexts.
+     *
+     * parse(p, text, context) makes context current on the calling thread for
+     * the call; outside of one, each thread has a default context. The scopes
+     * (failure_scope, memo_scope, ...) fill in whichever context is current.
+     * Rules reach it through one thread-local pointer, not through input_t:
+     * node builders such as kpml's get values, never the cursor.
+     */
+    class parse_context_t
+    {
+    public:
+        static constexpr std::size_t capacity = 8;
+
+        constexpr parse_context_t() = default;
+
+        parse_context_t(const parse_context_t&) = delete;
+        parse_context_t& operator=(const parse_context_t&) = delete;
+
+        // what the X slot holds, nullptr when empty
+        template<typename X>
+        X* get() const
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (slots[i].key == key<X>())
+                    return static_cast<X*>(slots[i].value);
+            }
+            return nullptr;
+        }
+
+        // x into the X slot (nullptr empties it); returns what it held
+        template<typename X>
+        X* set(X* x)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (slots[i].key == key<X>())
+                {
+                    const auto previous = static_cast<X*>(slots[i].value);
+                    slots[i].value = const_cast<void*>(static_cast<const void*>(x));
+                    return previous;
+                }
+            }
+            if (x == nullptr)
+                return nullptr;
+
+            // more slot types than any grammar uses: a programming error
+            if (count == capacity)
+                std::abort();
+            slots[count++] = slot_t{key<X>(), const_cast<void*>(static_cast<const void*>(x))};
+            return nullptr;
+        }
+
+        failure_t* failure{nullptr};   // its own member: every failing primitive tests it
+        std::size_t farthest{};        // the farthest offset a named rule reached (profiling)
+
+        // bumped by every top-level parse: memo entries of an earlier one are stale,
+        // even when its text lay at the same address
+        std::size_t generation{};
+
+        // nested(p) levels entered, and how many may be before a parse fails
+        std::size_t depth{};
+        std::size_t depth_limit{256};
+
+        // levels nested(p) refused: a result that met one depends on the depth it ran at
+        std::size_t depth_cuts{};
+
+        // the context of the parse running on this thread
+        static parse_context_t& current()
+        {
+            const auto c = installed();
+            return c != nullptr ? *c : fallback();
+        }
+
+        static parse_context_t*& installed()
+        {
+            thread_local parse_context_t* context = nullptr;
+            return context;
+        }
+
+    private:
+        struct slot_t
+        {
+            const void* key{nullptr};
+            void* value{nullptr};
+        };
+
+        // one address per type
+        template<typename X>
+        static const void* key()
+        {
+            static const char k{};
+            return &k;
+        }
+
+        static parse_context_t& fallback()
+        {
+            thread_local parse_context_t context;
+            return context;
+        }
+
+        slot_t slots[capacity]{};
+        std::size_t count{};
+    };
+
+
+    // makes context the current one on this thread for the lifetime of the scope
+    class context_scope
+    {
+    public:
+        explicit context_scope(parse_context_t& context)
+        : previous(parse_context_t::installed())
+        {
+            parse_context_t::installed() = &context;
+        }
+
+        ~context_scope() { parse_context_t::installed() = previous; }
+
+        context_scope(const context_scope&) = delete;
+        context_scope& operator=(const context_scope&) = delete;
+
+    private:
+        parse_context_t* previous;
+    };
+}
+
+#endif //PARSER_LPARSER_CONTEXT_HPP_H
@@ -0,0 +1,182 @@
+//
+// Farthest-failure tracking: where a parse got stuck and what it expected there
+//
+
+#ifndef PARSER_LPARSER_ERROR_HPP_H
+#define PARSER_LPARSER_ERROR_HPP_H
+
+#include "lparser_context.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace lparser
+{
+    /*
+     * Failing primitives report what they expected at the offset they failed at.
+     * Only the farthest offset is kept, alternatives failing at the same offset
+     * add up to its expected set. Nothing is recorded unless a failure_scope is
+     * active in the current context, so a plain parse pays a thread-local load per
+     * failed primitive and never builds a string: diagnose() re-runs a failed
+     * parse with a scope.
+     */
+
+    struct failure_t
+    {
+        // labels are views: they must outlive the scope (literals or parser members)
+        void expect(std::size_t at, std::string_view what)
+        {
+            if (any && at < pos)
+                return;
+
+            if (!any || at > pos)
+            {
+                pos = at;
+                any = true;
+                expected.clear();
+            }
+
+            if (std::find(expected.begin(), expected.end(), what) == expected.end())
+                expected.push_back(what);
+        }
+
+        void reset()
+        {
+            pos = 0;
+            any = false;
+            expected.clear();
+        }
+
+        // the record of the current context
+        static failure_t*& active() { return parse_context_t::current().failure; }
+
+        std::size_t pos{};
+        bool any{false};
+        std::vector<std::string_view> expected;
+    };
+
+    // records failures into f for the lifetime of the scope
+    class failure_scope
+    {
+    public:
+        explicit failure_scope(failure_t& f)
+        : context(parse_context_t::current()), prev(context.failure)
+        {
+            f.reset();
+            context.failure = &f;
+        }
+
+        ~failure_scope() { context.failure = prev; }
+
+        failure_scope(const failure_scope&) = delete;
+        failure_scope& operator=(const failure_scope&) = delete;
+
+    private:
+        parse_context_t& context;
+        failure_t* prev;
+    };
+
+    inline bool diagnosing() { return failure_t::active() != nullptr; }
+
+
+    struct position_t
+    {
+        std::size_t line{1};
+        std::size_t column{1};
+    };
+
+    // 1-based line and column of offset, counted on demand
+    inline position_t locate(std::string_view buffer, std::size_t offset)
+    {
+        offset = std::min(offset, buffer.size());
+
+        position_t p;
+        std::size_t start{};
+        const char* b = buffer.data();
+        while (const void* nl = std::memchr(b + start, '\n', offset - start))
+        {
+            start = static_cast<const char*>(nl) - b + 1;
+            ++p.line;
+        }
+        p.column = offset - start + 1;
+        return p;
+    }
+
+
+    struct parse_error_t
+    {
+        std::size_t offset{};
+        position_t position;
+        std::vector<std::string> expected;
+        std::string found;
+
+        std::string message() const
+        {
+            std::string m = std::to_string(position.line) + ":" + std::to_string(position.column) + ": ";
+            m += "unexpected " + (found.empty() ? std::string{"end of input"} : "'" + found + "'");
+
+            for (std::size_t i = 0; i < expected.size(); ++i)
+            {
+                if (i == 0)
+                    m += ", expected ";
+                else if (i + 1 == expected.size())
+                    m += " or ";
+                else
+                    m += ", ";
+                m += expected[i];
+            }
+            return m;
+        }
+    };
+
+    inline std::ostream& operator<<(std::ostream& out, const parse_error_t& e)
+    {
+        return out << e.message();
+    }
+
+    namespace detail
+    {
+        inline parse_error_t make_error(std::string_view buffer, const failure_t& f)
+        {
+            parse_error_t e;
+            e.offset = std::min(f.pos, buffer.size());
+            e.position = locate(buffer, e.offset);
+            e.expected.assign(f.expected.begin(), f.expected.end());
+            if (e.offset < buffer.size())
+                e.found = std::string(1, buffer[e.offset]);
+            return e;
+        }
+
+        // kept out of line: a failing primitive only inlines the active() test
+        [[gnu::noinline, gnu::cold]] inline void record_failure(failure_t& f, std::size_t at, std::string_view what)
+        {
+            f.expect(at, what);
+        }
+
+        // printable "'c'" labels for single characters, built once
+        inline std::string_view char_label(char c)
+        {
+            struct table_t
+            {
+                table_t()
+                {
+                    for (int i = 0; i < 256; ++i)
+                    {
+                        s[i][0] = '\'';
+                        s[i][1] = static_cast<char>(i);
+                        s[i][2] = '\'';
+                    }
+                }
+                char s[256][3];
+            };
+            static const table_t t;
+            return std::string_view{t.s[static_cast<unsigned char>(c)], 3};
+        }
+    }
+}
+
+#endif //PARSER_LPARSER_ERROR_HPP_H
@@ -0,0 +1,183 @@
+//
+// Files as parser input: mapped read-only and parsed in place (POSIX)
+//
+
+#ifndef PARSER_LPARSER_FILE_HPP_H
+#define PARSER_LPARSER_FILE_HPP_H
+
+#include "lparser.hpp"
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace lparser
+{
+    /*
+     * the bytes of a file, read-only. A regular file is mapped and parsed where
+     * it lies, with no copy; what mmap cannot take (pipes, devices, files that
+     * report no size) is read into a buffer of its own. Moving keeps the bytes
+     * where they are, so views into text() survive it.
+     */
+    class mapped_file_t
+    {
+    public:
+        mapped_file_t() = default;
+
+        explicit mapped_file_t(const std::string& path)
+        {
+            open(path);
+        }
+
+        ~mapped_file_t() { release(); }
+
+        mapped_file_t(mapped_file_t&& rhs) noexcept
+        : data(rhs.data), length(rhs.length), mapped(rhs.mapped), buffer(std::move(rhs.buffer)), ec(rhs.ec)
+        {
+            rhs.data = nullptr;
+            rhs.length = 0;
+            rhs.mapped = false;
+        }
+
+        mapped_file_t& operator=(mapped_file_t&& rhs) noexcept
+        {
+            if (this != &rhs)
+            {
+                release();
+                data = rhs.data;
+                length = rhs.length;
+                mapped = rhs.mapped;
+                buffer = std::move(rhs.buffer);
+                ec = rhs.ec;
+                rhs.data = nullptr;
+                rhs.length = 0;
+                rhs.mapped = false;
+            }
+            return *this;
+        }
+
+        mapped_file_t(const mapped_file_t&) = delete;
+        mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+        std::string_view text() const { return std::string_view{data, length}; }
+        std::size_t size() const { return length; }
+        bool is_mapped() const { return mapped; }
+
+        // why the file could not be read; text() is empty then
+        std::error_code error() const { return ec; }
+        explicit operator bool() const { return !ec; }
+
+    private:
+        static std::error_code last_error() { return std::error_code{errno, std::generic_category()}; }
+
+        void open(const std::string& path)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                ec = last_error();
+                return;
+            }
+
+            struct stat st{};
+            if (::fstat(fd, &st) != 0)
+            {
+                ec = last_error();
+                ::close(fd);
+                return;
+            }
+
+            if (S_ISREG(st.st_mode) && st.st_size > 0)
+            {
+                const auto n = static_cast<std::size_t>(st.st_size);
+                void* p = ::mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    // parsers mostly move forward: let the kernel read ahead
+                    ::madvise(p, n, MADV_SEQUENTIAL);
+                    data = static_cast<const char*>(p);
+                    length = n;
+                    mapped = true;
+                    ::close(fd);
+                    return;
+                }
+            }
+
+            read_all(fd);
+            ::close(fd);
+        }
+
+        void read_all(int fd)
+        {
+            constexpr std::size_t chunk = 64 * 1024;
+
+            std::size_t n{};
+            while (true)
+            {
+                buffer.resize(n + chunk);
+                const auto r = ::read(fd, buffer.data() + n, chunk);
+                if (r == 0)
+                    break;
+                if (r < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    ec = last_error();
+                    buffer.clear();
+                    return;
+                }
+                n += static_cast<std::size_t>(r);
+            }
+
+            buffer.resize(n);
+            data = buffer.data();
+            length = n;
+        }
+
+        void release()
+        {
+            if (mapped)
+                ::munmap(const_cast<char*>(data), length);
+            data = nullptr;
+            length = 0;
+            mapped = false;
+        }
+
+        const char* data{nullptr};
+        std::size_t length{};
+        bool mapped{false};
+        std::vector<char> buffer;
+        std::error_code ec;
+    };
+
+
+    // a parse result with the file its views refer into
+    template<typename T>
+    struct file_parse_t
+    {
+        mapped_file_t file;
+        parser_t<T> result;
+    };
+
+    // p over the bytes of the file at path; a file that cannot be read gives an empty result
+    template<typename Parser>
+    inline decltype(auto) parse_file(const std::string& path, Parser&& p)
+    {
+        using T = value_of_t<std::decay_t<Parser>>;
+
+        mapped_file_t file{path};
+        if (!file)
+            return file_parse_t<T>{std::move(file), empty<T>()};
+
+        auto r = parse(p, file.text());
+        return file_parse_t<T>{std::move(file), std::move(r)};
+    }
+}
+
+#endif //PARSER_LPARSER_FILE_HPP_H
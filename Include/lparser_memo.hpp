@@ -0,0 +1,234 @@
+//
+// Packrat memoization for lparser rules
+//
+
+#ifndef PARSER_LPARSER_MEMO_HPP_H
+#define PARSER_LPARSER_MEMO_HPP_H
+
+#include "lparser.hpp"
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+
+namespace lparser
+{
+    /*
+     * bounded memo table keyed by (rule id, input offset).
+     * It is direct mapped: a colliding entry overwrites the older one, so
+     * memory stays fixed whatever the input size and a miss only costs a re-parse.
+     * Entries carry the epoch they were stored in, so reset() is O(1): a table
+     * can be reused for many short inputs without sweeping its slots each time.
+     * It resets itself when a new top-level parse starts in the context, or the
+     * text changes address or size, so a buffer refilled in place is never
+     * served stale entries.
+     *
+     * Only values that are cheap handles (trivially copyable: an arena node id)
+     * are kept, and only those get packrat's linear bound. A tree value would
+     * be copied on every store and every hit, O(depth²) over a nested input:
+     * for such a T the table is a failure cache, a success hit runs the rule
+     * again.
+     * A result that met the depth limit of nested(p) is not stored: reached at
+     * a shallower depth the same rule may succeed.
+     */
+    template<typename T>
+    class memo_table_t
+    {
+    public:
+        explicit memo_table_t(std::size_t capacity = 4096)
+        {
+            std::size_t n = 1;
+            while (n < capacity)
+                n <<= 1;
+            slots.resize(n);
+            mask = n - 1;
+        }
+
+        void reset()
+        {
+            if (++epoch == 0)
+            {
+                for (auto& s : slots)
+                    s = slot_t{};
+                epoch = 1;
+            }
+            buffer = nullptr;
+            hits = misses = 0;
+        }
+
+        std::size_t capacity() const { return slots.size(); }
+        std::size_t hit_count() const { return hits; }
+        std::size_t miss_count() const { return misses; }
+
+        // a copy of the memoized result, or an empty optional
+        std::optional<parser_t<T>> find(std::size_t rule, const input_t& inp)
+        {
+            // a hit would hide the failures recorded inside the rule
+            if (diagnosing())
+                return {};
+
+            const auto now = parse_context_t::current().generation;
+            if (buffer != inp.buffer.data() || length != inp.buffer.size() || generation != now)
+            {
+                reset();
+                buffer = inp.buffer.data();
+                length = inp.buffer.size();
+                generation = now;
+            }
+
+            const auto& s = slots[index(rule, inp.pos)];
+            if (s.epoch != epoch || s.rule != rule || s.offset != inp.pos || (s.succeeded && !keeps_values))
+            {
+                ++misses;
+                return {};
+            }
+
+            ++hits;
+            if (!s.succeeded)
+            {
+                auto r = empty<T>(s.remain);
+                r.committed = s.committed;
+                return r;
+            }
+            return parser_t<T>{*s.value, s.remain};
+        }
+
+        void store(std::size_t rule, const input_t& inp, const parser_t<T>& r)
+        {
+            auto& s = slots[index(rule, inp.pos)];
+            s.epoch = epoch;
+            s.rule = rule;
+            s.offset = inp.pos;
+            s.succeeded = !r.is_empty();
+            if constexpr (keeps_values)
+                s.value = r.first;
+            s.remain = r.remain;
+            s.committed = r.committed;
+        }
+
+        // the table used by memo(rule_id, p) in the current context, if any
+        static memo_table_t* active() { return parse_context_t::current().get<memo_table_t>(); }
+
+    private:
+        static constexpr bool keeps_values = std::is_trivially_copyable_v<T>;
+
+        struct slot_t
+        {
+            std::size_t epoch{};
+            std::size_t rule{std::numeric_limits<std::size_t>::max()};
+            std::size_t offset{};
+            std::optional<T> value;   // kept only when keeps_values
+            input_t remain;
+            bool succeeded{false};
+            bool committed{false};
+        };
+
+        std::size_t index(std::size_t rule, std::size_t offset) const
+        {
+            return (offset * 31 + rule) & mask;
+        }
+
+        std::vector<slot_t> slots;
+        std::size_t mask{};
+        const char* buffer{nullptr};
+        std::size_t length{};
+        std::size_t generation{};
+        std::size_t epoch{1};
+        std::size_t hits{}, misses{};
+    };
+
+
+    // enables memoization of T-rules in the current context for its lifetime
+    template<typename T>
+    struct memo_scope
+    {
+        explicit memo_scope(memo_table_t<T>& table)
+        : context(parse_context_t::current())
+        {
+            table.reset();
+            previous = context.set(&table);
+        }
+
+        ~memo_scope() { context.set(previous); }
+
+        memo_scope(const memo_scope&) = delete;
+        memo_scope& operator=(const memo_scope&) = delete;
+
+    private:
+        parse_context_t& context;
+        memo_table_t<T>* previous;
+    };
+
+
+    namespace detail
+    {
+        // p through table t, storing what it gives unless that depended on the depth
+        template<typename T, typename P>
+        inline parser_t<T> memoized(memo_table_t<T>& t, std::size_t rule_id, const P& p, input_t inp)
+        {
+            if (auto hit = t.find(rule_id, inp))
+                return std::move(*hit);
+
+            const auto& context = parse_context_t::current();
+            const auto cuts = context.depth_cuts;
+            auto r = parse(p, inp);
+            if (context.depth_cuts == cuts)
+                t.store(rule_id, inp, r);
+            return r;
+        }
+    }
+
+    template<typename T, typename P>
+    struct memo_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            return detail::memoized(*table, rule_id, p, inp);
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        memo_table_t<T>* table;
+        std::size_t rule_id;
+        P p;
+    };
+
+    // memoize p in an explicit table
+    template<typename T, typename P>
+    inline decltype(auto) memo(memo_table_t<T>& table, std::size_t rule_id, P p)
+    {
+        return memo_t<T, P>{&table, rule_id, std::move(p)};
+    }
+
+
+    template<typename P>
+    struct scoped_memo_t
+    {
+        using value_t = value_of_t<P>;
+
+        parser_t<value_t> operator()(input_t inp) const
+        {
+            const auto t = memo_table_t<value_t>::active();
+            if (t == nullptr)
+                return parse(p, inp);
+            return detail::memoized(*t, rule_id, p, inp);
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        std::size_t rule_id;
+        P p;
+    };
+
+    // memoize p in the table of the enclosing memo_scope; a plain call without one
+    template<typename P>
+    inline decltype(auto) memo(std::size_t rule_id, P p)
+    {
+        return scoped_memo_t<P>{rule_id, std::move(p)};
+    }
+}
+
+#endif //PARSER_LPARSER_MEMO_HPP_H
@@ -0,0 +1,312 @@
+//
+// Numeric literal parsers built on std::from_chars
+//
+
+#ifndef PARSER_LPARSER_NUMERIC_HPP_H
+#define PARSER_LPARSER_NUMERIC_HPP_H
+
+#include "lparser.hpp"
+#include <charconv>
+#include <limits>
+#include <system_error>
+#include <type_traits>
+
+
+namespace lparser
+{
+    struct number_format_t
+    {
+        bool radix_prefix{false};   // 0x, 0o, 0b select the base of an integer
+        char separator{'\0'};       // digit group separator allowed between digits, e.g. '_'
+        bool point_required{false}; // floating: reject a literal with neither fraction nor exponent
+        bool sign{true};            // accept a leading '-' (signed integers and floats)
+    };
+
+    // a literal that was recognized but whose value may not fit: ec is result_out_of_range then
+    template<typename T>
+    struct numeric_result_t
+    {
+        T value{};
+        std::errc ec{};
+    };
+
+
+    namespace detail
+    {
+        inline const char_scanner_t& digit_scanner(int base)
+        {
+            static constexpr char_scanner_t bin{char_class_t::range('0', '1')};
+            static constexpr char_scanner_t oct{char_class_t::range('0', '7')};
+            static constexpr char_scanner_t dec{classes::digit};
+            static constexpr char_scanner_t hex{classes::xdigit};
+
+            switch (base)
+            {
+                case 2: return bin;
+                case 8: return oct;
+                case 16: return hex;
+                default: return dec;
+            }
+        }
+
+        // length of a run of digits, with single separators allowed between two digits
+        inline std::size_t scan_digits(std::string_view s, const char_scanner_t& digits, char sep, bool& separated)
+        {
+            auto n = digits.span(s);
+            if (n == 0 || sep == '\0')
+                return n;
+
+            while (n + 1 < s.size() && s[n] == sep && digits.char_class().contains(s[n + 1]))
+            {
+                separated = true;
+                n += 1 + digits.span(s.substr(n + 1));
+            }
+            return n;
+        }
+
+        /*
+         * runs f over the literal with its separators removed; the copy is only
+         * made when a separator was actually seen, on a stack buffer when it fits
+         */
+        template<typename F>
+        inline auto with_plain_digits(std::string_view s, char sep, bool separated, F f)
+        {
+            if (!separated)
+                return f(s.data(), s.data() + s.size());
+
+            char small[128];
+            std::string large;
+            char* out = small;
+            if (s.size() > sizeof(small))
+            {
+                large.resize(s.size());
+                out = large.data();
+            }
+
+            char* it = out;
+            for (const char ch : s)
+            {
+                if (ch != sep)
+                    *it++ = ch;
+            }
+            return f(out, it);
+        }
+    }
+
+
+    template<typename T>
+    struct integral_t
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>, "integral_t needs an integer type");
+
+        parser_t<numeric_result_t<T>> scan(input_t inp) const
+        {
+            using U = std::make_unsigned_t<T>;
+            using R = numeric_result_t<T>;
+
+            const auto s = inp.rest();
+            std::size_t pos{};
+
+            bool negative{false};
+            if constexpr (std::is_signed_v<T>)
+            {
+                if (fmt.sign && pos < s.size() && s[pos] == '-')
+                {
+                    negative = true;
+                    ++pos;
+                }
+            }
+
+            int base = 10;
+            if (fmt.radix_prefix && pos + 2 < s.size() && s[pos] == '0')
+            {
+                int b = 0;
+                switch (s[pos + 1])
+                {
+                    case 'x': case 'X': b = 16; break;
+                    case 'o': case 'O': b = 8; break;
+                    case 'b': case 'B': b = 2; break;
+                    default: break;
+                }
+                if (b != 0 && detail::digit_scanner(b).char_class().contains(s[pos + 2]))
+                {
+                    base = b;
+                    pos += 2;
+                }
+            }
+
+            bool separated{false};
+            const auto n = detail::scan_digits(s.substr(pos), detail::digit_scanner(base), fmt.separator, separated);
+            if (n == 0)
+            {
+                expected(inp, "integer");
+                return empty<R>(inp);
+            }
+
+            U magnitude{};
+            auto ec = detail::with_plain_digits(s.substr(pos, n), fmt.separator, separated, [&](const char* first, const char* last) {
+                return std::from_chars(first, last, magnitude, base).ec;
+            });
+
+            R r;
+            if (ec == std::errc{})
+            {
+                constexpr auto max = static_cast<U>(std::numeric_limits<T>::max());
+                if (!negative && magnitude > max)
+                    ec = std::errc::result_out_of_range;
+                else if (negative && magnitude > max + U{1})
+                    ec = std::errc::result_out_of_range;
+                else if (negative && magnitude == max + U{1})
+                    r.value = std::numeric_limits<T>::min();
+                else
+                    r.value = negative ? static_cast<T>(-static_cast<T>(magnitude)) : static_cast<T>(magnitude);
+            }
+            r.ec = ec;
+
+            return parser_t<R>{r, inp.advance(pos + n)};
+        }
+
+        /*
+         * fails on a literal out of the range of T, committed: the literal was
+         * recognized, and no shorter reading of it should be tried instead
+         */
+        parser_t<T> operator()(input_t inp) const
+        {
+            auto r = scan(inp);
+            if (r.is_empty())
+                return empty<T>(inp);
+            if (r.get().ec != std::errc{})
+            {
+                expected(inp, "number in range");
+                auto e = empty<T>(inp);
+                e.committed = true;
+                return e;
+            }
+            return parser_t<T>{r.get().value, r.remain};
+        }
+
+        first_t first_set() const
+        {
+            return first_t{fmt.sign ? classes::digit | char_class_t::of("-") : classes::digit, false};
+        }
+
+        number_format_t fmt;
+    };
+
+    template<typename T>
+    constexpr integral_t<T> integral(number_format_t fmt = {})
+    {
+        return integral_t<T>{fmt};
+    }
+
+
+    template<typename T>
+    struct floating_t
+    {
+        static_assert(std::is_floating_point_v<T>, "floating_t needs a floating point type");
+
+        parser_t<numeric_result_t<T>> scan(input_t inp) const
+        {
+            using R = numeric_result_t<T>;
+
+            const auto s = inp.rest();
+            const auto& digits = detail::digit_scanner(10);
+            std::size_t pos{};
+            bool separated{false};
+
+            if (fmt.sign && pos < s.size() && s[pos] == '-')
+                ++pos;
+
+            const auto int_part = detail::scan_digits(s.substr(pos), digits, fmt.separator, separated);
+            if (int_part == 0)
+            {
+                expected(inp, "decimal number");
+                return empty<R>(inp);
+            }
+            pos += int_part;
+
+            bool exact{false};
+            if (pos + 1 < s.size() && s[pos] == '.' && classes::digit(s[pos + 1]))
+            {
+                pos += 1 + detail::scan_digits(s.substr(pos + 1), digits, fmt.separator, separated);
+                exact = true;
+            }
+
+            if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E'))
+            {
+                auto e = pos + 1;
+                if (e < s.size() && (s[e] == '+' || s[e] == '-'))
+                    ++e;
+                const auto exp_part = digits.span(s.substr(std::min(e, s.size())));
+                if (exp_part > 0)
+                {
+                    pos = e + exp_part;
+                    exact = true;
+                }
+            }
+
+            if (fmt.point_required && !exact)
+            {
+                expected(inp, "decimal number");
+                return empty<R>(inp);
+            }
+
+            R r;
+            r.ec = detail::with_plain_digits(s.substr(0, pos), fmt.separator, separated, [&](const char* first, const char* last) {
+                return std::from_chars(first, last, r.value, std::chars_format::general).ec;
+            });
+
+            return parser_t<R>{r, inp.advance(pos)};
+        }
+
+        /*
+         * fails on a literal out of the range of T, committed: the literal was
+         * recognized, and no shorter reading of it should be tried instead
+         */
+        parser_t<T> operator()(input_t inp) const
+        {
+            auto r = scan(inp);
+            if (r.is_empty())
+                return empty<T>(inp);
+            if (r.get().ec != std::errc{})
+            {
+                expected(inp, "number in range");
+                auto e = empty<T>(inp);
+                e.committed = true;
+                return e;
+            }
+            return parser_t<T>{r.get().value, r.remain};
+        }
+
+        first_t first_set() const
+        {
+            return first_t{fmt.sign ? classes::digit | char_class_t::of("-") : classes::digit, false};
+        }
+
+        number_format_t fmt;
+    };
+
+    template<typename T>
+    constexpr floating_t<T> floating(number_format_t fmt = {})
+    {
+        return floating_t<T>{fmt};
+    }
+
+
+    template<typename P>
+    struct checked_t
+    {
+        decltype(auto) operator()(input_t inp) const { return p.scan(inp); }
+
+        P p;
+    };
+
+    // the literal with its range error instead of a failure, for callers that report overflow
+    template<typename P>
+    constexpr checked_t<P> checked(P p)
+    {
+        return checked_t<P>{p};
+    }
+}
+
+#endif //PARSER_LPARSER_NUMERIC_HPP_H
@@ -0,0 +1,230 @@
+//
+// Parsing independent segments of a text on a work-stealing thread pool
+//
+
+#ifndef PARSER_LPARSER_PARALLEL_HPP_H
+#define PARSER_LPARSER_PARALLEL_HPP_H
+
+#include "lparser.hpp"
+#include "lparser_stream.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lparser
+{
+    /*
+     * a fixed set of threads running index loops. for_each(n, f) deals [0, n)
+     * out as one contiguous range per thread; a thread takes indices from the
+     * front of its own range, and once it is empty steals the back half of the
+     * fullest other range, so uneven items still spread over every thread.
+     * The calling thread works too.
+     */
+    class work_pool_t
+    {
+    public:
+        explicit work_pool_t(std::size_t threads = std::thread::hardware_concurrency())
+        : ranges(std::max<std::size_t>(threads, 1))
+        {
+            for (std::size_t w = 1; w < ranges.size(); ++w)
+                workers.emplace_back([this, w] { serve(w); });
+        }
+
+        ~work_pool_t()
+        {
+            {
+                std::lock_guard<std::mutex> guard{lock};
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& t : workers)
+                t.join();
+        }
+
+        work_pool_t(const work_pool_t&) = delete;
+        work_pool_t& operator=(const work_pool_t&) = delete;
+
+        std::size_t size() const { return ranges.size(); }
+
+        // f(i) for every i in [0, n), in no particular order; returns when all are done
+        template<typename F>
+        void for_each(std::size_t n, F&& f)
+        {
+            if (n == 0)
+                return;
+
+            const auto k = ranges.size();
+            for (std::size_t w = 0; w < k; ++w)
+            {
+                std::lock_guard<std::mutex> guard{ranges[w].lock};
+                ranges[w].next = n * w / k;
+                ranges[w].last = n * (w + 1) / k;
+            }
+
+            const auto call = [](const void* fn, std::size_t i) { (*static_cast<const std::remove_reference_t<F>*>(fn))(i); };
+            {
+                std::lock_guard<std::mutex> guard{lock};
+                job = job_t{call, &f};
+                busy = k - 1;
+                ++generation;
+            }
+            wake.notify_all();
+
+            work(0, job_t{call, &f});
+
+            std::unique_lock<std::mutex> guard{lock};
+            done.wait(guard, [this] { return busy == 0; });
+        }
+
+    private:
+        struct job_t
+        {
+            void (*call)(const void*, std::size_t);
+            const void* fn;
+        };
+
+        struct range_t
+        {
+            std::mutex lock;
+            std::size_t next{}, last{};
+        };
+
+        void serve(std::size_t w)
+        {
+            std::size_t seen{};
+            while (true)
+            {
+                job_t j;
+                {
+                    std::unique_lock<std::mutex> guard{lock};
+                    wake.wait(guard, [&] { return stopping || generation != seen; });
+                    if (stopping)
+                        return;
+                    seen = generation;
+                    j = job;
+                }
+
+                work(w, j);
+
+                std::lock_guard<std::mutex> guard{lock};
+                if (--busy == 0)
+                    done.notify_one();
+            }
+        }
+
+        void work(std::size_t w, const job_t& j)
+        {
+            std::size_t i;
+            while (take(w, i) || (steal(w) && take(w, i)))
+                j.call(j.fn, i);
+        }
+
+        bool take(std::size_t w, std::size_t& i)
+        {
+            auto& r = ranges[w];
+            std::lock_guard<std::mutex> guard{r.lock};
+            if (r.next == r.last)
+                return false;
+            i = r.next++;
+            return true;
+        }
+
+        // moves the back half of the fullest other range to w; false when every range is empty
+        bool steal(std::size_t w)
+        {
+            while (true)
+            {
+                std::size_t victim = w, most{};
+                for (std::size_t v = 0; v < ranges.size(); ++v)
+                {
+                    if (v == w)
+                        continue;
+                    std::lock_guard<std::mutex> guard{ranges[v].lock};
+                    if (ranges[v].last - ranges[v].next > most)
+                    {
+                        most = ranges[v].last - ranges[v].next;
+                        victim = v;
+                    }
+                }
+                if (victim == w)
+                    return false;
+
+                std::size_t first{}, last{};
+                {
+                    std::lock_guard<std::mutex> guard{ranges[victim].lock};
+                    auto& r = ranges[victim];
+                    if (r.next == r.last)
+                        continue;
+                    first = r.next + (r.last - r.next) / 2;
+                    last = r.last;
+                    r.last = first;
+                }
+
+                std::lock_guard<std::mutex> guard{ranges[w].lock};
+                ranges[w].next = first;
+                ranges[w].last = last;
+                return true;
+            }
+        }
+
+        std::vector<range_t> ranges;
+        std::vector<std::thread> workers;
+
+        std::mutex lock;
+        std::condition_variable wake, done;
+        job_t job{};
+        std::size_t generation{};
+        std::size_t busy{};
+        bool stopping{false};
+    };
+
+
+    /*
+     * p over each segment of text, in parallel; the results in segment order.
+     * A segment is parsed where it lies in text, so offsets and remain cursors
+     * are those of the whole text, and it has to be consumed entirely, as with
+     * parse_all. Every segment is parsed in a fresh context, on the calling
+     * thread as on the pool's: the caller's scopes (memo, failure, ast) are
+     * never seen. An exception thrown by p is rethrown here, once every
+     * segment is done; that of the first segment when several throw.
+     */
+    template<typename Parser>
+    inline decltype(auto) parse_segments(const Parser& p, std::string_view text, const std::vector<segment_t>& segments, work_pool_t& pool)
+    {
+        using T = value_of_t<Parser>;
+
+        std::vector<parser_t<T>> results(segments.size());
+        std::vector<std::exception_ptr> errors(segments.size());
+        pool.for_each(segments.size(), [&](std::size_t i) {
+            try
+            {
+                const auto& s = segments[i];
+                parse_context_t context;
+                context_scope in{context};
+                auto r = parse(p, input_t{text.substr(0, s.last), s.first});
+                if (!r.is_empty() && !r.remain.empty())
+                    r = empty<T>(r.remain);
+                results[i] = std::move(r);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        });
+
+        for (const auto& e : errors)
+        {
+            if (e)
+                std::rethrow_exception(e);
+        }
+        return results;
+    }
+}
+
+#endif //PARSER_LPARSER_PARALLEL_HPP_H
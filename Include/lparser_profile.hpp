@@ -0,0 +1,204 @@
+//
+// Per-rule profiling, compiled in with UPARSEC_PROFILE
+//
+
+#ifndef PARSER_LPARSER_PROFILE_HPP_H
+#define PARSER_LPARSER_PROFILE_HPP_H
+
+#include "lparser.hpp"
+#include <iomanip>
+
+#ifdef UPARSEC_PROFILE
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#endif
+
+
+namespace lparser
+{
+    namespace profile
+    {
+        struct rule_stats_t
+        {
+            std::string name;
+            std::uint64_t calls{}, successes{}, failures{};
+            std::uint64_t consumed{};    // bytes matched by successful calls
+            std::uint64_t backtracked{}; // bytes matched under a failed call before it gave up
+            std::uint64_t nanoseconds{}; // inclusive of nested rules
+        };
+
+#ifdef UPARSEC_PROFILE
+        namespace detail
+        {
+            struct counters_t
+            {
+                explicit counters_t(std::string n) : name(std::move(n)) {}
+
+                std::string name;
+                std::atomic<std::uint64_t> calls{}, successes{}, failures{}, consumed{}, backtracked{}, nanoseconds{};
+            };
+
+            struct registry_t
+            {
+                std::mutex lock;
+                std::deque<counters_t> rules;
+            };
+
+            inline registry_t& registry()
+            {
+                static registry_t r;
+                return r;
+            }
+
+            // rules of the same name share their counters
+            inline counters_t& counters(const std::string& name)
+            {
+                auto& r = registry();
+                std::lock_guard<std::mutex> guard{r.lock};
+                for (auto& c : r.rules)
+                {
+                    if (c.name == name)
+                        return c;
+                }
+                return r.rules.emplace_back(name);
+            }
+        }
+#endif
+
+        // a snapshot of every named rule seen so far
+        inline std::vector<rule_stats_t> stats()
+        {
+            std::vector<rule_stats_t> out;
+#ifdef UPARSEC_PROFILE
+            auto& r = detail::registry();
+            std::lock_guard<std::mutex> guard{r.lock};
+            for (const auto& c : r.rules)
+            {
+                out.push_back(rule_stats_t{
+                        c.name, c.calls.load(), c.successes.load(), c.failures.load(),
+                        c.consumed.load(), c.backtracked.load(), c.nanoseconds.load()
+                });
+            }
+#endif
+            return out;
+        }
+
+        inline void reset()
+        {
+#ifdef UPARSEC_PROFILE
+            auto& r = detail::registry();
+            std::lock_guard<std::mutex> guard{r.lock};
+            for (auto& c : r.rules)
+            {
+                c.calls = c.successes = c.failures = 0;
+                c.consumed = c.backtracked = c.nanoseconds = 0;
+            }
+#endif
+        }
+
+        inline void report(std::ostream& out)
+        {
+            out << std::left << std::setw(20) << "rule" << std::right
+                << std::setw(12) << "calls" << std::setw(12) << "ok" << std::setw(12) << "failed"
+                << std::setw(14) << "consumed" << std::setw(14) << "backtracked"
+                << std::setw(12) << "ms" << "\n";
+
+            for (const auto& s : stats())
+            {
+                out << std::left << std::setw(20) << s.name << std::right
+                    << std::setw(12) << s.calls << std::setw(12) << s.successes << std::setw(12) << s.failures
+                    << std::setw(14) << s.consumed << std::setw(14) << s.backtracked
+                    << std::setw(12) << std::fixed << std::setprecision(3) << s.nanoseconds / 1e6 << "\n";
+            }
+        }
+
+        inline void report_json(std::ostream& out)
+        {
+            out << "[";
+            bool f{false};
+            for (const auto& s : stats())
+            {
+                if (f)
+                    out << ", ";
+                else
+                    f = true;
+
+                out << R"({ "rule": ")" << s.name << "\""
+                    << ", \"calls\": " << s.calls
+                    << ", \"successes\": " << s.successes
+                    << ", \"failures\": " << s.failures
+                    << ", \"consumed\": " << s.consumed
+                    << ", \"backtracked\": " << s.backtracked
+                    << ", \"nanoseconds\": " << s.nanoseconds << " }";
+            }
+            out << "]";
+        }
+    }
+
+
+#ifdef UPARSEC_PROFILE
+    template<typename P>
+    struct named_t
+    {
+        auto operator()(input_t inp) const
+        {
+            using clock = std::chrono::steady_clock;
+
+            auto& farthest = parse_context_t::current().farthest;
+            const auto outer = farthest;
+            farthest = inp.pos;
+            const auto start = clock::now();
+
+            auto r = parse(p, inp);
+
+            stats->calls.fetch_add(1, std::memory_order_relaxed);
+            stats->nanoseconds.fetch_add(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count(),
+                    std::memory_order_relaxed
+            );
+
+            if (r.is_empty())
+            {
+                // a failure's remain is where its failing step stopped, when it kept one
+                if (r.remain.buffer.data() == inp.buffer.data())
+                    farthest = std::max(farthest, r.remain.pos);
+
+                stats->failures.fetch_add(1, std::memory_order_relaxed);
+                stats->backtracked.fetch_add(farthest - inp.pos, std::memory_order_relaxed);
+            }
+            else
+            {
+                stats->successes.fetch_add(1, std::memory_order_relaxed);
+                stats->consumed.fetch_add(r.remain.pos - inp.pos, std::memory_order_relaxed);
+                farthest = std::max(farthest, r.remain.pos);
+            }
+
+            farthest = std::max(outer, farthest);
+            return r;
+        }
+
+        first_t first_set() const { return first_of(p); }
+
+        P p;
+        profile::detail::counters_t* stats;
+    };
+
+    // p, counted in the profile under name
+    template<typename P>
+    inline decltype(auto) named(const char* name, P p)
+    {
+        return named_t<P>{std::move(p), &profile::detail::counters(name)};
+    }
+#else
+    // profiling is compiled out: p itself
+    template<typename P>
+    constexpr P named(const char*, P p)
+    {
+        return p;
+    }
+#endif
+}
+
+#endif //PARSER_LPARSER_PROFILE_HPP_H
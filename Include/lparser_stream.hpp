@@ -0,0 +1,224 @@
+//
+// Push parsing: statements parsed as their text arrives in chunks
+//
+
+#ifndef PARSER_LPARSER_STREAM_HPP_H
+#define PARSER_LPARSER_STREAM_HPP_H
+
+#include "lparser.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace lparser
+{
+    // how statements are told apart in a stream: outside brackets and quotes, a separator
+    // ends the statement before it, a terminator the statement it closes
+    struct delimiters_t
+    {
+        char separator{';'};
+        char terminator{'\0'};   // a closing bracket, when it closes the outermost pair
+        char_class_t open{char_class_t::of("({[")};
+        char_class_t close{char_class_t::of(")}]")};
+        char quote{'"'};
+    };
+
+
+    namespace detail
+    {
+        // finds statement ends, keeping the bracket depth and the quote state across calls
+        class boundary_scanner_t
+        {
+        public:
+            explicit boundary_scanner_t(const delimiters_t& d)
+            : delims(d),
+              plain(~(d.open | d.close | char_class_t::of(std::string_view{&d.separator, 1}) | char_class_t::of(std::string_view{&d.quote, 1}))),
+              quoted(~char_class_t::of(std::string_view{&d.quote, 1}))
+            {}
+
+            /*
+             * scans s from pos to the end of the next statement: true with pos past
+             * its last byte and end past its text (a separator is not part of it,
+             * a terminator is); false with pos at the end of s when none ends in it
+             */
+            bool next(std::string_view s, std::size_t& pos, std::size_t& end)
+            {
+                while (pos < s.size())
+                {
+                    pos += (in_quote ? quoted : plain).span(s.substr(pos));
+                    if (pos == s.size())
+                        break;
+
+                    const char c = s[pos++];
+                    if (c == delims.quote)
+                    {
+                        in_quote = !in_quote;
+                    }
+                    else if (in_quote)
+                    {
+                        continue;
+                    }
+                    else if (delims.open.contains(c))
+                    {
+                        ++depth;
+                    }
+                    else if (delims.close.contains(c))
+                    {
+                        depth = depth > 0 ? depth - 1 : 0;
+                        if (c == delims.terminator && depth == 0)
+                        {
+                            end = pos;
+                            return true;
+                        }
+                    }
+                    else if (c == delims.separator && depth == 0)
+                    {
+                        end = pos - 1;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void reset()
+            {
+                depth = 0;
+                in_quote = false;
+            }
+
+        private:
+            delimiters_t delims;
+            char_scanner_t plain;    // bytes that neither nest, quote nor delimit
+            char_scanner_t quoted;   // bytes inside a quoted string
+            std::size_t depth{};
+            bool in_quote{false};
+        };
+
+        inline bool blank(std::string_view s)
+        {
+            return take_while(classes::space)(input_t{s}).remain.pos == s.size();
+        }
+    }
+
+
+    // a statement of a text: [first, last) its bytes, separator excluded
+    struct segment_t
+    {
+        std::size_t first;
+        std::size_t last;
+    };
+
+    // the statements of text in order, found without parsing them; blank ones are left out
+    inline std::vector<segment_t> split(std::string_view text, const delimiters_t& d = {})
+    {
+        detail::boundary_scanner_t scanner{d};
+        std::vector<segment_t> out;
+
+        std::size_t pos{}, start{}, end{};
+        while (scanner.next(text, pos, end))
+        {
+            if (!detail::blank(text.substr(start, end - start)))
+                out.push_back(segment_t{start, end});
+            start = pos;
+        }
+        if (!detail::blank(text.substr(start)))
+            out.push_back(segment_t{start, text.size()});
+        return out;
+    }
+
+
+    /*
+     * p over a stream of delimited statements fed in chunks of any size.
+     * Each byte is scanned once for the end of its statement; a statement is
+     * parsed whole, with parse_all(p, text), as soon as its end arrives, and
+     * its bytes are released. Only the statement being received is buffered.
+     *
+     * sink(result, text, offset) receives every statement, failed ones too, with
+     * its text and the offset of that text in the stream.
+     * Both refer into the buffer: they are only valid during the call.
+     */
+    template<typename P>
+    class push_parser_t
+    {
+    public:
+        using value_t = value_of_t<P>;
+
+        explicit push_parser_t(P parser, delimiters_t d = {})
+        : p(std::move(parser)), scanner(d)
+        {}
+
+        // the number of statements chunk completed
+        template<typename Sink>
+        std::size_t feed(std::string_view chunk, Sink&& sink)
+        {
+            pending.append(chunk.data(), chunk.size());
+
+            std::size_t n{};
+            std::size_t start{}, end{};
+            while (scanner.next(pending, scanned, end))
+            {
+                run(std::string_view{pending}.substr(start, end - start), start, sink);
+                start = scanned;
+                ++n;
+            }
+
+            if (start > 0)
+                release(start);
+            return n;
+        }
+
+        // the end of the stream: the last statement needs no delimiter; a blank one is dropped
+        template<typename Sink>
+        std::size_t finish(Sink&& sink)
+        {
+            std::size_t n{};
+            if (!detail::blank(pending))
+            {
+                run(pending, 0, sink);
+                n = 1;
+            }
+
+            consumed += pending.size();
+            pending.clear();
+            scanned = 0;
+            scanner.reset();
+            return n;
+        }
+
+        // bytes held for the statement being received
+        std::size_t buffered() const { return pending.size(); }
+
+        // bytes of the stream already parsed and released
+        std::size_t released() const { return consumed; }
+
+    private:
+        template<typename Sink>
+        void run(std::string_view text, std::size_t at, Sink& sink)
+        {
+            sink(parse_all(p, text), text, consumed + at);
+        }
+
+        void release(std::size_t n)
+        {
+            pending.erase(0, n);
+            scanned -= n;
+            consumed += n;
+        }
+
+        P p;
+        detail::boundary_scanner_t scanner;
+
+        std::string pending;
+        std::size_t scanned{};
+        std::size_t consumed{};
+    };
+
+    template<typename P>
+    inline decltype(auto) push_parser(P p, delimiters_t d = {})
+    {
+        return push_parser_t<P>{std::move(p), d};
+    }
+}
+
+#endif //PARSER_LPARSER_STREAM_HPP_H
@@ -0,0 +1,285 @@
+//
+// Structural index: the brackets, quotes and separators of a text, and which brackets pair up
+//
+
+#ifndef PARSER_LPARSER_STRUCTURE_HPP_H
+#define PARSER_LPARSER_STRUCTURE_HPP_H
+
+#include "lparser.hpp"
+#include "lparser_stream.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define UPARSEC_AVX2_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+
+namespace lparser
+{
+    namespace detail
+    {
+        // bit i is the parity of the set bits 0..i of x
+        inline std::uint64_t prefix_xor(std::uint64_t x)
+        {
+            x ^= x << 1;
+            x ^= x << 2;
+            x ^= x << 4;
+            x ^= x << 8;
+            x ^= x << 16;
+            x ^= x << 32;
+            return x;
+        }
+
+        // a 64 byte block classified: the members of a class, and the quotes
+        struct block_bits_t
+        {
+            std::uint64_t members;
+            std::uint64_t quotes;
+        };
+
+        inline block_bits_t classify_scalar(const char* p, const char_class_t& cls, char quote)
+        {
+            block_bits_t b{0, 0};
+            for (unsigned i = 0; i < 64; ++i)
+            {
+                b.members |= std::uint64_t{cls.contains(p[i])} << i;
+                b.quotes |= std::uint64_t{p[i] == quote} << i;
+            }
+            return b;
+        }
+
+#ifdef UPARSEC_AVX2_DISPATCH
+        // an ASCII class as two nibble tables: c is a member when lo[c & 15] & hi[c >> 4]
+        [[gnu::target("avx2")]] inline block_bits_t classify_avx2(const char* p, const std::uint8_t* lo, const std::uint8_t* hi, char quote)
+        {
+            const auto lo_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lo)));
+            const auto hi_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)));
+            const auto low4 = _mm256_set1_epi8(0x0F);
+            const auto zero = _mm256_setzero_si256();
+            const auto q = _mm256_set1_epi8(quote);
+
+            block_bits_t b{0, 0};
+            for (int half = 0; half < 2; ++half)
+            {
+                const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * half));
+                const auto l = _mm256_and_si256(x, low4);
+                const auto h = _mm256_and_si256(_mm256_srli_epi16(x, 4), low4);
+                const auto hit = _mm256_and_si256(_mm256_shuffle_epi8(lo_tbl, l), _mm256_shuffle_epi8(hi_tbl, h));
+                const auto miss = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, zero)));
+                const auto quotes = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, q)));
+                b.members |= std::uint64_t{~miss} << (32 * half);
+                b.quotes |= std::uint64_t{quotes} << (32 * half);
+            }
+            return b;
+        }
+
+        inline bool cpu_has_avx2()
+        {
+            static const bool yes = __builtin_cpu_supports("avx2");
+            return yes;
+        }
+#else
+        inline bool cpu_has_avx2() { return false; }
+#endif
+    }
+
+
+    /*
+     * the offsets of the structural bytes of a text: brackets, separators and
+     * extra ones such as ',', outside quoted strings, and the quotes themselves;
+     * each bracket with its partner. Built in two passes, as simdjson does:
+     * 64 byte blocks are classified to bitmaps (AVX2 when the CPU has it, picked
+     * at run time, else a scalar loop) and strings are masked out with a prefix
+     * xor of the quote bits; then the offsets are extracted from the bitmaps and
+     * brackets paired with a stack. Like the boundary scanner any closer pairs
+     * with the innermost opener, and strings have no escapes.
+     * Offsets are 32 bits: the text is at most max_text bytes, and a longer one
+     * is split by the boundary scanner instead.
+     */
+    class structural_index_t
+    {
+    public:
+        static constexpr std::size_t none = std::numeric_limits<std::uint32_t>::max();
+        static constexpr std::size_t max_text = none;
+
+        explicit structural_index_t(std::string_view text, const delimiters_t& d = {}, const char_class_t& extra = char_class_t::of(","))
+        : source(text), delims(d)
+        {
+            // its offsets would wrap: the caller should have checked max_text
+            if (text.size() > max_text)
+                std::abort();
+
+            auto cls = d.open | d.close | extra | char_class_t::of(std::string_view{&d.separator, 1});
+            cls = cls & ~char_class_t::of(std::string_view{&d.quote, 1});
+            vector_path = detail::cpu_has_avx2() && ascii(cls);
+            index(cls);
+            pair();
+        }
+
+        std::string_view text() const { return source; }
+        const delimiters_t& delimiters() const { return delims; }
+
+        // whether the blocks were classified with AVX2
+        bool vectorized() const { return vector_path; }
+
+        std::size_t size() const { return offsets.size(); }
+        std::size_t offset(std::size_t k) const { return offsets[k]; }
+        char byte(std::size_t k) const { return source[offsets[k]]; }
+
+        // the index of the bracket paired with bracket k, none when it is unpaired or no bracket
+        std::size_t partner(std::size_t k) const
+        {
+            return partners[k] == std::numeric_limits<std::uint32_t>::max() ? none : partners[k];
+        }
+
+        // the first structural byte at or after offset: its index, or size()
+        std::size_t find(std::size_t offset) const
+        {
+            return static_cast<std::size_t>(std::lower_bound(offsets.begin(), offsets.end(), offset) - offsets.begin());
+        }
+
+        // the offset of the bracket closing the one opened at offset, none when unclosed
+        std::size_t closing(std::size_t open) const
+        {
+            const auto k = find(open);
+            if (k == size() || offsets[k] != open || partners[k] == std::numeric_limits<std::uint32_t>::max())
+                return none;
+            return offsets[partners[k]];
+        }
+
+    private:
+        static bool ascii(const char_class_t& c) { return c.bits[2] == 0 && c.bits[3] == 0; }
+
+        void index(const char_class_t& cls)
+        {
+            std::uint8_t lo[16]{}, hi[16]{};
+            for (unsigned u = 0; u < 128; ++u)
+            {
+                if (cls.contains(static_cast<char>(u)))
+                    lo[u & 0x0F] |= static_cast<std::uint8_t>(1u << (u >> 4));
+            }
+            for (unsigned h = 0; h < 8; ++h)
+                hi[h] = static_cast<std::uint8_t>(1u << h);
+
+            // the last partial block is padded with a byte that is neither structural nor a quote
+            char pad = ' ';
+            while (cls.contains(pad) || pad == delims.quote)
+                ++pad;
+
+            offsets.reserve(source.size() / 8);
+            std::uint64_t in_string{};
+            for (std::size_t base = 0; base < source.size(); base += 64)
+            {
+                const char* p = source.data() + base;
+                char tail[64];
+                if (source.size() - base < 64)
+                {
+                    std::memset(tail, pad, sizeof(tail));
+                    std::memcpy(tail, p, source.size() - base);
+                    p = tail;
+                }
+
+                detail::block_bits_t b;
+#ifdef UPARSEC_AVX2_DISPATCH
+                if (vector_path)
+                    b = detail::classify_avx2(p, lo, hi, delims.quote);
+                else
+#endif
+                    b = detail::classify_scalar(p, cls, delims.quote);
+
+                // set from an opening quote up to the byte before its closing one
+                const auto inside = detail::prefix_xor(b.quotes) ^ in_string;
+                in_string = static_cast<std::uint64_t>(0) - (inside >> 63);
+
+                auto keep = (b.members & ~inside) | b.quotes;
+                while (keep != 0)
+                {
+                    offsets.push_back(static_cast<std::uint32_t>(base + __builtin_ctzll(keep)));
+                    keep &= keep - 1;
+                }
+            }
+        }
+
+        void pair()
+        {
+            partners.assign(offsets.size(), std::numeric_limits<std::uint32_t>::max());
+            std::vector<std::uint32_t> open;
+            for (std::size_t k = 0; k < offsets.size(); ++k)
+            {
+                const char c = source[offsets[k]];
+                if (delims.open.contains(c))
+                {
+                    open.push_back(static_cast<std::uint32_t>(k));
+                }
+                else if (delims.close.contains(c) && !open.empty())
+                {
+                    partners[k] = open.back();
+                    partners[open.back()] = static_cast<std::uint32_t>(k);
+                    open.pop_back();
+                }
+            }
+        }
+
+        std::string_view source;
+        delimiters_t delims;
+        bool vector_path{false};
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> partners;
+    };
+
+
+    // as split(text, delimiters), hopping from each opener at the top level straight to its partner
+    inline std::vector<segment_t> split(const structural_index_t& index)
+    {
+        const auto text = index.text();
+        const auto& d = index.delimiters();
+        std::vector<segment_t> out;
+
+        const auto emit = [&](std::size_t first, std::size_t last) {
+            if (!detail::blank(text.substr(first, last - first)))
+                out.push_back(segment_t{first, last});
+        };
+
+        std::size_t start{};
+        for (std::size_t k = 0; k < index.size(); ++k)
+        {
+            const char c = index.byte(k);
+            if (d.open.contains(c))
+            {
+                // an unclosed bracket holds the rest of the text
+                k = index.partner(k);
+                if (k == structural_index_t::none)
+                    break;
+                if (index.byte(k) == d.terminator)
+                {
+                    emit(start, index.offset(k) + 1);
+                    start = index.offset(k) + 1;
+                }
+            }
+            else if (d.close.contains(c))
+            {
+                if (c == d.terminator)
+                {
+                    emit(start, index.offset(k) + 1);
+                    start = index.offset(k) + 1;
+                }
+            }
+            else if (c == d.separator)
+            {
+                emit(start, index.offset(k));
+                start = index.offset(k) + 1;
+            }
+        }
+
+        emit(start, text.size());
+        return out;
+    }
+}
+
+#endif //PARSER_LPARSER_STRUCTURE_HPP_H
@@ -0,0 +1,239 @@
+//
+// Token streams: a lexer's output parsed with the ordinary combinators
+//
+
+#ifndef PARSER_LPARSER_TOKEN_HPP_H
+#define PARSER_LPARSER_TOKEN_HPP_H
+
+#include "lparser.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+
+namespace lparser
+{
+    /*
+     * A lexer turns the text into a flat array of lexemes in one pass. Each
+     * lexeme also contributes one byte, its kind, to a string of kinds, and the
+     * grammar runs on that string with the usual input_t: seq, choice, many,
+     * sep_by, expression... work unchanged, choice dispatches on the kind of
+     * the next token and positions count tokens. Primitives reach the payload
+     * of a token through the stream of the enclosing token_scope.
+     * Offsets and lengths are 32 bits: a stream covers a text of at most
+     * token_stream_t::max_text bytes, and a lexer rejects a longer one.
+     */
+
+    struct lexeme_t
+    {
+        char kind{};
+        std::uint32_t offset{};   // into the text
+        std::uint32_t length{};
+        std::uint32_t id{};       // interned name, or literal value; up to the lexer
+    };
+
+    // a literal value converted by the lexer, so the grammar never scans it again
+    using literal_t = std::variant<std::uint64_t, double>;
+
+
+    class token_stream_t
+    {
+    public:
+        static constexpr std::size_t max_text = std::numeric_limits<std::uint32_t>::max();
+
+        token_stream_t() = default;
+
+        // the lexemes refer into text: it has to outlive the stream
+        explicit token_stream_t(std::string_view text)
+        : source(text)
+        {}
+
+        // empty again over a new text, keeping the storage
+        void reset(std::string_view text)
+        {
+            source = text;
+            kind_bytes.clear();
+            tokens.clear();
+            names.clear();
+            ids.clear();
+            values.clear();
+        }
+
+        void push(char kind, std::size_t offset, std::size_t length, std::uint32_t id = 0)
+        {
+            // a token past max_text would wrap: the lexer should have rejected the text
+            if (offset > max_text || length > max_text - offset)
+                std::abort();
+
+            kind_bytes.push_back(kind);
+            tokens.push_back(lexeme_t{kind, static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(length), id});
+        }
+
+        // the same id for every occurrence of a spelling
+        std::uint32_t intern(std::string_view s)
+        {
+            const auto it = ids.find(s);
+            if (it != ids.end())
+                return it->second;
+
+            const auto id = static_cast<std::uint32_t>(names.size());
+            names.push_back(s);
+            ids.emplace(s, id);
+            return id;
+        }
+
+        std::uint32_t add_literal(literal_t v)
+        {
+            values.push_back(v);
+            return static_cast<std::uint32_t>(values.size() - 1);
+        }
+
+        std::string_view name(std::uint32_t id) const { return names[id]; }
+        const literal_t& literal(std::uint32_t id) const { return values[id]; }
+
+        const lexeme_t& operator[](std::size_t i) const { return tokens[i]; }
+        std::size_t size() const { return tokens.size(); }
+
+        std::string_view text() const { return source; }
+        std::string_view kinds() const { return kind_bytes; }
+
+        std::string_view spelling(std::size_t i) const
+        {
+            return source.substr(tokens[i].offset, tokens[i].length);
+        }
+
+        // where token i starts in the text; the end of the text past the last one
+        std::size_t offset_of(std::size_t i) const
+        {
+            return i < tokens.size() ? tokens[i].offset : source.size();
+        }
+
+        // the stream the token primitives read in the current context
+        static const token_stream_t* active() { return parse_context_t::current().get<const token_stream_t>(); }
+
+    private:
+        std::string_view source;
+        std::string kind_bytes;
+        std::vector<lexeme_t> tokens;
+        std::vector<std::string_view> names;
+        std::unordered_map<std::string_view, std::uint32_t> ids;
+        std::vector<literal_t> values;
+    };
+
+
+    // routes the token primitives of the current context to a stream for its lifetime
+    class token_scope
+    {
+    public:
+        explicit token_scope(const token_stream_t& tokens)
+        : context(parse_context_t::current()), previous(context.set(&tokens))
+        {}
+
+        ~token_scope() { context.set(previous); }
+
+        token_scope(const token_scope&) = delete;
+        token_scope& operator=(const token_scope&) = delete;
+
+    private:
+        parse_context_t& context;
+        const token_stream_t* previous;
+    };
+
+    inline const token_stream_t& current_tokens()
+    {
+        // a token rule run outside a token_scope: a programming error, not a parse failure
+        const auto tokens = token_stream_t::active();
+        if (tokens == nullptr)
+        {
+            std::fputs("lparser: token rule run without a token_scope\n", stderr);
+            std::abort();
+        }
+        return *tokens;
+    }
+
+
+    struct kind_eq_t
+    {
+        parser_t<lexeme_t> operator()(input_t inp) const
+        {
+            if (!inp.empty() && inp.peek() == kind)
+                return parser_t<lexeme_t>{current_tokens()[inp.pos], inp.advance(1)};
+
+            expected(inp, what);
+            return empty<lexeme_t>(inp);
+        }
+
+        first_t first_set() const { return first_t{char_class_t::of(std::string_view{&kind, 1}), false}; }
+
+        char kind;
+        std::string_view what;
+    };
+
+    // the next token, when it is of the given kind
+    inline decltype(auto) kind_eq(char kind, std::string_view what)
+    {
+        return kind_eq_t{kind, what};
+    }
+
+    // a punctuation token whose kind is its own character
+    inline decltype(auto) kind_eq(char kind)
+    {
+        return kind_eq_t{kind, detail::char_label(kind)};
+    }
+
+
+    // the result refers into the stream: it has to outlive the parse result
+    template<typename Parser>
+    decltype(auto) parse(Parser && p, const token_stream_t& stream)
+    {
+        token_scope scope{stream};
+        return p(detail::start(stream.kinds()));
+    }
+
+    template<typename Parser>
+    void parse(Parser && p, token_stream_t&& stream) = delete;
+
+    template<typename Parser>
+    inline decltype(auto) parse_all(Parser&& p, const token_stream_t& stream)
+    {
+        token_scope scope{stream};
+        return parse_all(p, stream.kinds());
+    }
+
+    namespace detail
+    {
+        inline parse_error_t make_error(const token_stream_t& stream, const failure_t& f)
+        {
+            const auto at = std::min(f.pos, stream.size());
+
+            parse_error_t e;
+            e.offset = stream.offset_of(at);
+            e.position = locate(stream.text(), e.offset);
+            e.expected.assign(f.expected.begin(), f.expected.end());
+            if (at < stream.size())
+                e.found = std::string{stream.spelling(at)};
+            return e;
+        }
+    }
+
+    // as diagnose over text, the error located in the text the tokens came from
+    template<typename Parser>
+    inline parse_error_t diagnose(Parser&& p, const token_stream_t& stream)
+    {
+        failure_t f;
+        {
+            token_scope scope{stream};
+            failure_scope failures{f};
+            parse_all(p, stream.kinds());
+        }
+        return detail::make_error(stream, f);
+    }
+}
+
+#endif //PARSER_LPARSER_TOKEN_HPP_H
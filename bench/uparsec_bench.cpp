@@ -0,0 +1,571 @@
+/*
+ * uparsec_bench: throughput, allocations and peak heap of the lparser
+ * primitives and of the kpml grammar over synthetic, reproducible corpora.
+ *
+ * usage: uparsec_bench [name filter] [min seconds per benchmark]
+ * */
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Include/lparser.hpp"
+#include "../Include/lparser_bricks.hpp"
+#include "../Include/kpml.hpp"
+#include "../Include/kpml_ast.hpp"
+#include "../Include/kpml_lexer.hpp"
+#include "../Include/kpml_session.hpp"
+#include "../Include/kpml_vm.hpp"
+#include "../Include/lparser_profile.hpp"
+
+
+using namespace lparser;
+
+
+/* heap accounting: every allocation carries its size in a header */
+
+namespace heap
+{
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> live{0};
+    std::atomic<std::size_t> peak{0};
+
+    constexpr std::size_t header = alignof(std::max_align_t);
+
+    void* allocate(std::size_t n)
+    {
+        auto p = static_cast<char*>(std::malloc(n + header));
+        if (p == nullptr)
+            throw std::bad_alloc{};
+
+        *reinterpret_cast<std::size_t*>(p) = n;
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        const auto now = live.fetch_add(n, std::memory_order_relaxed) + n;
+        auto top = peak.load(std::memory_order_relaxed);
+        while (now > top && !peak.compare_exchange_weak(top, now, std::memory_order_relaxed))
+            ;
+        return p + header;
+    }
+
+    void release(void* ptr)
+    {
+        if (ptr == nullptr)
+            return;
+
+        auto p = static_cast<char*>(ptr) - header;
+        live.fetch_sub(*reinterpret_cast<std::size_t*>(p), std::memory_order_relaxed);
+        std::free(p);
+    }
+}
+
+void* operator new(std::size_t n) { return heap::allocate(n); }
+void* operator new[](std::size_t n) { return heap::allocate(n); }
+void operator delete(void* p) noexcept { heap::release(p); }
+void operator delete[](void* p) noexcept { heap::release(p); }
+void operator delete(void* p, std::size_t) noexcept { heap::release(p); }
+void operator delete[](void* p, std::size_t) noexcept { heap::release(p); }
+
+
+/* synthetic corpora, fixed seed */
+
+namespace corpus
+{
+    std::mt19937 rng{20170115};
+
+    std::string identifiers(std::size_t count, std::size_t length)
+    {
+        static const char tail[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+        std::string s;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            s += static_cast<char>('a' + rng() % 26);
+            for (std::size_t j = 1; j < length; j++)
+                s += tail[rng() % (sizeof(tail) - 1)];
+            s += ' ';
+        }
+        return s;
+    }
+
+    std::string letters(std::size_t n, const std::string& alphabet)
+    {
+        std::string s;
+        for (std::size_t i = 0; i < n; i++)
+            s += alphabet[rng() % alphabet.size()];
+        return s;
+    }
+
+    std::string nats(std::size_t count)
+    {
+        std::string s = "[";
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if (i > 0)
+                s += ", ";
+            s += std::to_string(rng() % 1000000);
+        }
+        return s + "]";
+    }
+
+    std::string nested_expr(std::size_t depth)
+    {
+        static const char* ops[] = {" + ", " - ", " * ", " / "};
+        std::string s;
+        for (std::size_t i = 0; i < depth; i++)
+            s += "(x" + std::to_string(i) + ops[rng() % 4];
+        s += "1";
+        s.append(depth, ')');
+        return s;
+    }
+
+    std::string flat_expr(std::size_t terms)
+    {
+        static const char* ops[] = {" + ", " - ", " * ", " > ", " == "};
+        std::string s = "a0";
+        for (std::size_t i = 1; i < terms; i++)
+        {
+            const auto n = std::to_string(i);
+            s += ops[rng() % 5];
+            s += rng() % 2 ? "a" + n : "f(" + n + ")";
+        }
+        return s;
+    }
+
+    std::string wide_call(std::size_t args)
+    {
+        std::string s = "apply_all(";
+        for (std::size_t i = 0; i < args; i++)
+        {
+            if (i > 0)
+                s += ", ";
+            s += (i % 3 == 0) ? std::to_string(i) : "arg" + std::to_string(i);
+        }
+        return s + ")";
+    }
+
+    // one short statement per line, the shape of an ingestion feed
+    std::string short_statements(std::size_t count)
+    {
+        static const char* shapes[] = {"x{} + {} * y", "f(a{}, {}) > 2", "\"v{}\" == s", "if (n{} < {}) { 1 } else { 0 }"};
+        std::string s;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::string line = shapes[i % 4];
+            for (auto at = line.find("{}"); at != std::string::npos; at = line.find("{}"))
+                line.replace(at, 2, std::to_string(i % 97));
+            s += line + "\n";
+        }
+        return s;
+    }
+
+    std::vector<std::string_view> lines(const std::string& s)
+    {
+        std::vector<std::string_view> out;
+        for (std::size_t at = 0, end; at < s.size(); at = end + 1)
+        {
+            end = s.find('\n', at);
+            out.push_back(std::string_view{s}.substr(at, end - at));
+        }
+        return out;
+    }
+
+    std::string function_defs(std::size_t count)
+    {
+        std::string s;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            const auto n = std::to_string(i);
+            s += "def fun_" + n + "(x, y, z) { if ((x + " + n + ") > y) { \"ok" + n + "\" } "
+                 "else { if (y > 0) { g(x, y * 2, z) } else { is_null(x) } } ; x + y * z }\n";
+        }
+        return s;
+    }
+}
+
+
+/*
+ * the baseline of the VM: evaluates statement_t trees as they are, comparing
+ * node names, looking symbols up by name and functions in a map on every visit
+ */
+namespace walk
+{
+    using kpml::vm::value_t;
+    using env_t = std::vector<std::pair<std::string, value_t>>;
+
+    struct evaluator_t
+    {
+        std::map<std::string, const kpml::statement_t*> defs;
+
+        explicit evaluator_t(const std::vector<kpml::statement_t>& program)
+        {
+            for (const auto& d : program)
+                defs.emplace(*d.operands[0].leaf_if<std::string>(), &d);
+        }
+
+        bool call(const std::string& name, const env_t& args, value_t& out) const
+        {
+            const auto it = defs.find(name);
+            if (it == defs.end())
+                return false;
+            const auto& d = *it->second;
+            env_t env;
+            for (std::size_t i = 0; i < args.size(); ++i)
+                env.emplace_back(d.operands[1].operands[i].leaf_if<kpml::symbol_t>()->name, args[i].second);
+            return eval(d.operands[2], env, out);
+        }
+
+        bool eval(const kpml::statement_t& s, const env_t& env, value_t& out) const
+        {
+            if (s.is_leaf())
+            {
+                if (const auto u = s.leaf_if<std::uint64_t>())
+                    out = value_t::integer(*u);
+                else if (const auto d = s.leaf_if<double>())
+                    out = value_t::real(*d);
+                else if (const auto str = s.leaf_if<std::string>())
+                    out = value_t::string(str);
+                else
+                {
+                    const auto& name = s.leaf_if<kpml::symbol_t>()->name;
+                    const auto v = std::find_if(env.begin(), env.end(), [&](const auto& e) { return e.first == name; });
+                    if (v == env.end())
+                        return false;
+                    out = v->second;
+                }
+                return true;
+            }
+
+            if (s.op == "if")
+            {
+                value_t c;
+                bool b;
+                if (!eval(s.operands[0], env, c) || !kpml::vm::truth(c, b))
+                    return false;
+                return eval(s.operands[b ? 1 : 2], env, out);
+            }
+            if (s.op == "begin")
+            {
+                for (const auto& x : s.operands)
+                {
+                    if (!eval(x, env, out))
+                        return false;
+                }
+                return !s.operands.empty();
+            }
+            if (s.op == "apply")
+            {
+                env_t args;
+                for (std::size_t i = 1; i < s.operands.size(); ++i)
+                {
+                    value_t v;
+                    if (!eval(s.operands[i], env, v))
+                        return false;
+                    args.emplace_back(std::string{}, v);
+                }
+                return call(s.operands[0].leaf_if<kpml::symbol_t>()->name, args, out);
+            }
+
+            const auto& ops = kpml::operators();
+            for (std::size_t op = 0; op < ops.size(); ++op)
+            {
+                if (ops[op].token == s.op)
+                {
+                    value_t a, b;
+                    return eval(s.operands[0], env, a) && eval(s.operands[1], env, b) && kpml::vm::binary(op, a, b, out);
+                }
+            }
+            return false;
+        }
+    };
+
+    const std::string program =
+            "def fib(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }\n"
+            "def mix(n) { if (n == 0) { 0.5 } else { (mix(n - 1) * 3 + n / 2) / 2 } }\n";
+
+    inline std::vector<kpml::statement_t> defs()
+    {
+        return parse_all(many(token(kpml::function_def)), program).get();
+    }
+}
+
+
+/*
+ * the stress of sharing one grammar: every thread parses the same defs with
+ * the same rule objects, diagnostics on, each in its own context,
+ * and has to get what a single thread gets
+ */
+namespace shared
+{
+    struct outcome_t
+    {
+        std::size_t consumed;
+        std::size_t nodes;
+        std::size_t error;
+
+        bool operator==(const outcome_t& o) const { return consumed == o.consumed && nodes == o.nodes && error == o.error; }
+    };
+
+    inline std::size_t nodes(const kpml::statement_t& s)
+    {
+        std::size_t n = 1;
+        for (const auto& x : s.operands)
+            n += nodes(x);
+        return n;
+    }
+
+    inline std::vector<outcome_t> run(const std::vector<std::string_view>& defs)
+    {
+        std::vector<outcome_t> out;
+        out.reserve(defs.size());
+        for (const auto d : defs)
+        {
+            const auto r = parse_all(kpml::function_def, d);
+            out.push_back(r.is_empty()
+                    ? outcome_t{0, 0, diagnose(kpml::function_def, d).offset}
+                    : outcome_t{r.remain.pos, nodes(r.get()), 0});
+        }
+        return out;
+    }
+
+    // every other def cut short, so half of them fail and get diagnosed
+    inline std::vector<std::string_view> defs(const std::string& s)
+    {
+        auto out = corpus::lines(s);
+        for (std::size_t i = 1; i < out.size(); i += 2)
+            out[i] = out[i].substr(0, out[i].size() / 2);
+        return out;
+    }
+
+    inline bool stress(const std::vector<std::string_view>& defs, std::size_t threads)
+    {
+        static const auto expected = run(defs);
+
+        std::atomic<std::size_t> agree{};
+        std::vector<std::thread> pool;
+        for (std::size_t t = 0; t < threads; ++t)
+        {
+            pool.emplace_back([&] {
+                parse_context_t context;
+                context_scope in{context};
+                if (run(defs) == expected)
+                    ++agree;
+            });
+        }
+        for (auto& t : pool)
+            t.join();
+        return agree == threads;
+    }
+}
+
+
+/* harness */
+
+struct bench_t
+{
+    std::string name;
+    std::string input;
+    std::function<bool(const std::string&)> run;
+};
+
+struct result_t
+{
+    double seconds{};
+    std::size_t iterations{};
+    std::size_t allocations{};
+    std::size_t peak{};
+};
+
+result_t measure(const bench_t& b, double min_seconds)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (!b.run(b.input))
+    {
+        std::cerr << b.name << ": the corpus does not parse" << std::endl;
+        std::exit(1);
+    }
+
+    result_t r;
+    const auto allocations = heap::allocations.load();
+    heap::peak = heap::live.load();
+    const auto base = heap::live.load();
+
+    const auto start = clock::now();
+    do
+    {
+        b.run(b.input);
+        r.iterations++;
+        r.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    }
+    while (r.seconds < min_seconds);
+
+    r.allocations = heap::allocations.load() - allocations;
+    r.peak = heap::peak.load() - base;
+    return r;
+}
+
+
+template <typename P>
+bool parses_all(const P& p, const std::string& s)
+{
+    const auto r = parse(p, s);
+    return !r.is_empty() && r.remain.empty();
+}
+
+
+int main(int argc, char** argv)
+{
+    const std::string filter = argc > 1 ? argv[1] : "";
+    const double min_seconds = argc > 2 ? std::atof(argv[2]) : 0.5;
+
+    const std::vector<bench_t> benches{
+            {"item", corpus::letters(1 << 16, "abcdefgh"), [](const std::string& s) {
+                return parses_all(many(item), s);
+            }},
+            {"many_sat", corpus::letters(1 << 16, "0123456789"), [](const std::string& s) {
+                return parses_all(many(digit), s);
+            }},
+            {"seq", corpus::letters(1 << 16, "abcd"), [](const std::string& s) {
+                return parses_all(many(seq(item, item, item, item)), s);
+            }},
+            {"pipe", corpus::letters(1 << 16, "abcd"), [](const std::string& s) {
+                return parses_all(many(pipe(char_eq('a'), char_eq('b'), char_eq('c'), char_eq('d'))), s);
+            }},
+            {"ident_long", corpus::identifiers(512, 120), [](const std::string& s) {
+                return parses_all(many(token(ident)), s);
+            }},
+            {"nats", corpus::nats(10000), [](const std::string& s) {
+                return parses_all(nats, s);
+            }},
+            {"expr_nested", corpus::nested_expr(400), [](const std::string& s) {
+                // deeper than the default depth_limit, which this thread's stack can take
+                static parse_context_t deep;
+                deep.depth_limit = 1024;
+                const auto r = parse(kpml::expr, s, deep);
+                return !r.is_empty() && r.remain.empty();
+            }},
+            {"expr_flat", corpus::flat_expr(5000), [](const std::string& s) {
+                return parses_all(kpml::expr, s);
+            }},
+            {"function_call_wide", corpus::wide_call(5000), [](const std::string& s) {
+                return parses_all(kpml::function_call, s);
+            }},
+            {"function_def_many", corpus::function_defs(400), [](const std::string& s) {
+                return parses_all(many(kpml::function_def), s);
+            }},
+            {"function_def_many_parallel", corpus::function_defs(400), [](const std::string& s) {
+                static work_pool_t pool;
+                const auto defs = kpml::parse_definitions(s, pool);
+                return std::all_of(defs.begin(), defs.end(), [](const auto& d) { return !d.is_empty(); });
+            }},
+            {"function_def_many_lexed", corpus::function_defs(400), [](const std::string& s) {
+                static token_stream_t tokens;
+                kpml::lex(s, tokens);
+                const auto r = parse(many(kpml::lexed::function_def), tokens);
+                return !r.is_empty() && r.remain.empty();
+            }},
+            {"expr_flat_lexed", corpus::flat_expr(5000), [](const std::string& s) {
+                static token_stream_t tokens;
+                kpml::lex(s, tokens);
+                const auto r = parse(kpml::lexed::expr, tokens);
+                return !r.is_empty() && r.remain.empty();
+            }},
+            {"split_scan", corpus::function_defs(4000), [](const std::string& s) {
+                return split(s, kpml::definition_delimiters).size() == 4000;
+            }},
+            {"split_indexed", corpus::function_defs(4000), [](const std::string& s) {
+                return split(structural_index_t{s, kpml::definition_delimiters}).size() == 4000;
+            }},
+            {"lex", corpus::function_defs(400), [](const std::string& s) {
+                static token_stream_t tokens;
+                kpml::lex(s, tokens);
+                return tokens.size() > 0;
+            }},
+            {"statements_one_by_one", corpus::short_statements(20000), [](const std::string& s) {
+                static const auto inputs = corpus::lines(s);
+                return std::all_of(inputs.begin(), inputs.end(), [](std::string_view line) {
+                    const auto r = parse(kpml::statement, line);
+                    return !r.is_empty() && r.remain.empty();
+                });
+            }},
+            {"statements_batch", corpus::short_statements(20000), [](const std::string& s) {
+                static const auto inputs = corpus::lines(s);
+                static kpml::parser_session_t session;
+                const auto& r = session.parse(inputs);
+                return std::all_of(r.status.begin(), r.status.end(), [](auto x) { return x == kpml::parse_status_t::ok; });
+            }},
+            {"statements_batch_threads", corpus::short_statements(20000), [](const std::string& s) {
+                static const auto inputs = corpus::lines(s);
+                static kpml::parser_session_t session{4};
+                const auto& r = session.parse(inputs);
+                return std::all_of(r.status.begin(), r.status.end(), [](auto x) { return x == kpml::parse_status_t::ok; });
+            }},
+            {"shared_grammar_threads", corpus::function_defs(400), [](const std::string& s) {
+                static const auto defs = shared::defs(s);
+                return shared::stress(defs, 8);
+            }},
+            {"eval_tree_walk", walk::program, [](const std::string&) {
+                static const auto defs = walk::defs();
+                static const walk::evaluator_t eval{defs};
+                kpml::vm::value_t fib, mix;
+                return eval.call("fib", {{"", kpml::vm::value_t::integer(18)}}, fib) && fib.u == 2584
+                       && eval.call("mix", {{"", kpml::vm::value_t::integer(200)}}, mix);
+            }},
+            {"eval_vm", walk::program, [](const std::string&) {
+                static const auto program = kpml::vm::compile(walk::defs());
+                static kpml::vm::machine_t vm{program};
+                const auto fib = vm.call("fib", {kpml::vm::value_t::integer(18)});
+                return fib && fib->u == 2584 && vm.call("mix", {kpml::vm::value_t::integer(200)});
+            }},
+            {"function_def_many_arena", corpus::function_defs(400), [](const std::string& s) {
+                static kpml::ast_t ast;
+                kpml::ast_scope scope{ast};
+                ast.clear();
+                return parses_all(many(kpml::arena::function_def), s);
+            }},
+    };
+
+    std::cout << std::left << std::setw(26) << "benchmark"
+              << std::right << std::setw(10) << "bytes"
+              << std::setw(10) << "iters"
+              << std::setw(12) << "MB/s"
+              << std::setw(14) << "allocs/byte"
+              << std::setw(14) << "peak KiB" << std::endl;
+
+    for (const auto& b : benches)
+    {
+        if (b.name.find(filter) == std::string::npos)
+            continue;
+
+        const auto r = measure(b, min_seconds);
+        const double bytes = double(b.input.size()) * r.iterations;
+
+        std::cout << std::left << std::setw(26) << b.name
+                  << std::right << std::setw(10) << b.input.size()
+                  << std::setw(10) << r.iterations
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << bytes / r.seconds / 1e6
+                  << std::setprecision(4)
+                  << std::setw(14) << r.allocations / bytes
+                  << std::setprecision(1)
+                  << std::setw(14) << r.peak / 1024.0
+                  << std::endl;
+    }
+
+#ifdef UPARSEC_PROFILE
+    std::cout << std::endl;
+    profile::report(std::cout);
+#endif
+
+    return 0;
+}
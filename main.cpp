@@ -11,9 +11,22 @@
 #include <utility>
 #include <memory>
 #include <sstream>
+#include <iterator>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
 #include "Include/lparser.hpp"
 #include "Include/lparser_bricks.hpp"
+#include "Include/lparser_choice.hpp"
+#include "Include/lparser_file.hpp"
+#include "Include/lparser_numeric.hpp"
 #include "Include/kpml.hpp"
+#include "Include/kpml_ast.hpp"
+#include "Include/kpml_fold.hpp"
+#include "Include/kpml_lexer.hpp"
+#include "Include/kpml_session.hpp"
+#include "Include/kpml_vm.hpp"
 
 
 using namespace lparser;
@@ -42,20 +55,36 @@ int main()
 
     std::cout << "seq " << parse(seq(char_eq('I'), char_eq('n'), char_eq('g')), "Inghe") << std::endl;
     std::cout << "string_eq " << parse(string_eq("Ing"), "Inghe") << std::endl;
+    std::cout << "one_of " << parse(one_of({">", ">=", "="}), ">= 1") << std::endl;
+    std::cout << "keywords " << parse(keywords({"if", "else", "def"}), "else {") << std::endl;
+    std::cout << "keyword " << parse(keyword("if"), "iffy") << std::endl;
+    std::cout << "choice " << parse(choice(nat, fmap(char_eq('-'), [](char) { return -1L; })), "-5") << std::endl;
 
     std::cout << "many(space) " << parse(space, " 123abc") << std::endl;
     std::cout << "many(digit) " << parse(many(digit), "123abc") << std::endl;
     std::cout << "some(digit) " << parse(some(digit), "123abc") << std::endl;
     std::cout << "some(digit) " << parse(some(digit), "x23abc") << std::endl;
     std::cout << "some(letter) " << parse(some(letter), "abc123abc") << std::endl;
+    std::cout << "many_fold " << parse(many_fold(token(nat), 0L, [](long& sum, long x) { sum += x; }), "1 2 3 x") << std::endl;
+    std::cout << "skip_many " << parse(skip_many(char_eq('a')), "aaab") << std::endl;
+    std::cout << "count " << parse(count(2, digit), "123") << std::endl;
+    std::cout << "sep_end_by " << parse(sep_end_by(nat, char_eq(';')), "1;2;3;x") << std::endl;
+
+    std::string letters;
+    parse(many_to(letter, std::back_inserter(letters)), "abc123");
+    std::cout << "many_to " << letters << std::endl;
 
     std::cout << "ident " << parse(ident, "abc123 abc") << std::endl;
     std::cout << "nat " << parse(nat, "1789abc") << std::endl;
     std::cout << "space " << parse(space, "    abc") << std::endl;
+    std::cout << "take_while " << parse(take_while(classes::ident_tail | classes::space), "abc_12 x-y") << std::endl;
 
     std::cout << "intg " << parse(intg, "1235") << std::endl;
     std::cout << "intg " << parse(intg, "-1235   xxx") << std::endl;
     std::cout << "integer " << parse(integer, "  -107     95") << std::endl;
+    std::cout << "integral " << parse(integral<std::uint32_t>({true, '_'}), "0xFF_FF;") << std::endl;
+    std::cout << "integral " << parse(integral<std::int16_t>(), "40000") << std::endl;
+    std::cout << "floating " << parse(floating<double>(), "-2.5e3 m") << std::endl;
 
     std::cout << "symbol " << parse(symbol("A"), " [ x ] ") << std::endl;
     std::cout << "symbol " << parse(symbol("x"), " x = 123 ") << std::endl;
@@ -64,6 +93,12 @@ int main()
 
     std::cout << "nats " << parse(nats, "[5, 8, 1982, 3 ]") << std::endl;
 
+    const auto minus = parser_bind(symbol("-"), [](auto) {
+        return pure(std::function<long(long, long)>{std::minus<long>{}});
+    });
+    std::cout << "chainl1 " << parse(chainl1(natural, minus), "10 - 3 - 2") << std::endl;
+    std::cout << "chainr1 " << parse(chainr1(natural, minus), "10 - 3 - 2") << std::endl;
+
     const std::string fp_body = "myfun(x, y, 5+ 4)";
     const auto fp = parse(kpml::function_call, fp_body);
     std::cout << fp_body << ": ";
@@ -73,9 +108,184 @@ int main()
     const std::string expr_s = "((5  * 7) + myfun(x) * (31 - 9) + 21);finish!";
     check_statement(parse(kpml::expr, expr_s), expr_s);
 
+    {
+        auto folded = parse(kpml::expr, expr_s).get();
+        const auto rewritten = kpml::simplify(folded);
+        std::cout << "folded (" << rewritten << " nodes): ";
+        show_statement(folded);
+        std::cout << std::endl;
+
+        auto decided = parse(kpml::statement, "if (2 > 1 && 3 >= 0.5) { 3 * 4 + 1.5 } else { y }").get();
+        kpml::simplify(decided);
+        std::cout << "folded if: ";
+        show_statement(decided);
+        std::cout << std::endl;
+    }
+
     const std::string fun_def = "def my_fun(x, y) { if ((x + 1) > 0) { \"hello\" } else { if (y > 0) { y } else { is_null(x) } } } ;finish!";
     check_statement(parse(kpml::function_def, fun_def), fun_def);
 
+    kpml::ast_t ast;
+    {
+        kpml::ast_scope scope{ast};
+        const auto compact = parse(kpml::arena::function_def, fun_def);
+        if (!compact.is_empty())
+        {
+            std::cout << "arena: ";
+            ast.show(std::cout, compact.get());
+            std::cout << ", nodes: " << ast.size() << std::endl;
+        }
+        ast.clear();
+    }
+
+    std::string nested_s;
+    for (int i = 0; i < 64; i++)
+        nested_s += "(1 + ";
+    nested_s += "x";
+    for (int i = 0; i < 64; i++)
+        nested_s += ")";
+
+    kpml::packrat_t memo;
+    {
+        kpml::packrat_scope scope{memo};
+        const auto nested = parse(kpml::expr, nested_s);
+        std::cout << "packrat nested expr: " << (nested.is_empty() ? "invalid" : "ok")
+                  << ", memo hits: " << memo.hit_count()
+                  << ", misses: " << memo.miss_count()
+                  << std::endl;
+    }
+
+    const auto fun_tokens = kpml::lex(fun_def);
+    const auto lexed = parse(kpml::lexed::function_def, fun_tokens);
+    std::cout << "lexed (" << fun_tokens.size() << " tokens): ";
+    show_statement(lexed.get());
+    std::cout << ", not parsed: " << fun_def.substr(fun_tokens.offset_of(lexed.remain.pos)) << std::endl;
+
+    const auto path = (std::filesystem::temp_directory_path() / "uparsec_demo.kpml").string();
+    std::ofstream{path} << "def f(x) { x + 1 }\ndef g(y) { f(y) * \"two\" }\n";
+    {
+        const auto defs = parse_file(path, many(token(kpml::function_def)));
+        std::cout << "parse_file: " << defs.result.get().size() << " defs, "
+                  << defs.file.size() << " bytes, mapped: " << defs.file.is_mapped() << std::endl;
+
+        // the string leaves of the arena point into the mapping instead of being copied
+        mapped_file_t file{path};
+        kpml::ast_scope scope{ast};
+        ast.borrow(file.text());
+        const auto g = parse(many(token(kpml::arena::function_def)), file.text());
+        const auto name = ast.text(ast.child(g.get()[1], 0));
+        std::cout << "borrowed leaf: " << name << ", in the mapping: "
+                  << (name.data() >= file.text().data() && name.data() < file.text().data() + file.size()) << std::endl;
+        ast.clear();
+        ast.borrow({});
+    }
+    std::filesystem::remove(path);
+    const auto none = parse_file("/dev/null", many(kpml::function_def));
+    std::cout << "parse_file /dev/null: " << none.result.get().size() << " defs, mapped: " << none.file.is_mapped() << std::endl;
+    std::cout << "parse_file missing: " << parse_file(path, many(kpml::function_def)).file.error().message() << std::endl;
+
+    // statements come out as soon as their ';' arrives, whatever the chunking
+    const std::string piped = "x + 1; f(y, \"a\") * 2; if (x > 1) { g(x; y) } else { z }; 7";
+    auto stream = kpml::statement_stream();
+    const auto on_statement = [&stream](const parser_t<kpml::statement_t>& r, std::string_view text, std::size_t offset) {
+        std::cout << "  @" << offset << " <" << text << "> " << (r.is_empty() ? "invalid" : "ok")
+                  << ", buffered: " << stream.buffered() << std::endl;
+    };
+    std::cout << "streamed:" << std::endl;
+    for (std::size_t i = 0; i < piped.size(); i += 5)
+        stream.feed(std::string_view{piped}.substr(i, 5), on_statement);
+    stream.finish(on_statement);
+
+    const std::string bundle = "def a(x) { x + 1 }\ndef b(y) { \"q\" }\ndef c(z) { z * }\ndef d(w) { if (w > 0) { w } else { 0 } ; w }\n";
+    work_pool_t pool{4};
+    const auto defs = kpml::parse_definitions(bundle, pool);
+    std::cout << "parallel defs:";
+    for (const auto& d : defs)
+        std::cout << " " << (d.is_empty() ? "invalid@" + std::to_string(d.remain.pos) : "ok");
+    std::cout << std::endl;
+
+    const structural_index_t structure{fun_def};
+    const auto open_body = fun_def.find('{');
+    std::cout << "structural: " << structure.size() << " structural bytes, body " << open_body
+              << ".." << structure.closing(open_body) << std::endl;
+
+    // one call for many short inputs; the scratch state is reused by the next batch
+    const std::vector<std::string> feed{"x + 1", "f(y, \"a\") * 2", "if (x > 1) { y } else { z }", "x +", "g(1) h"};
+    kpml::parser_session_t session;
+    const auto& batch = session.parse(feed);
+    std::cout << "batch:";
+    for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+        static const char* status[] = {"ok", "partial", "invalid"};
+        std::cout << " " << status[static_cast<int>(batch.status[i])] << "/" << batch.consumed[i];
+    }
+    std::cout << ", ";
+    session.ast(1).show(std::cout, batch.root[1]);
+    std::cout << std::endl;
+
+    // one grammar for every thread: all they must not share is the context
+    std::size_t same{};
+    std::vector<std::thread> workers;
+    std::mutex tally;
+    for (int t = 0; t < 4; ++t)
+    {
+        workers.emplace_back([&] {
+            parse_context_t context;
+            const auto r = parse(kpml::function_def, fun_def, context);
+
+            // scopes fill the context made current, here for the rest of the thread
+            context_scope in{context};
+            kpml::packrat_t memo;
+            kpml::packrat_scope packrat{memo};
+            const auto e = diagnose(kpml::function_def, "def f(x) { x + }");
+            std::lock_guard<std::mutex> guard{tally};
+            same += !r.is_empty() && r.remain.pos == fun_def.find(';') && e.offset == 15;
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    std::cout << "shared grammar: " << same << " of " << workers.size() << " threads agree" << std::endl;
+
+    // compiled once to bytecode: symbols are slots and calls function indices when it runs
+    using kpml::vm::value_t;
+    const std::string program_text = fun_def.substr(0, fun_def.find(';'))
+            + "\ndef fib(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }\ndef ratio(x, y) { x / y }";
+    const auto is_null = [](const value_t* args, value_t& out) {
+        out = value_t::integer(args[0].kind != value_t::kind_t::string && args[0].u == 0);
+        return true;
+    };
+    const auto program = kpml::vm::compile(parse_all(many(token(kpml::function_def)), program_text).get(), {{"is_null", 1, is_null}});
+    kpml::vm::machine_t vm{program};
+    std::cout << "vm: " << program.code.size() << " instructions, fib(20) = " << *vm.call("fib", {value_t::integer(20)})
+              << ", my_fun(0, 0) = " << *vm.call("my_fun", {value_t::integer(0), value_t::integer(0)})
+              << ", ratio(7.5, 2) = " << *vm.call("ratio", {value_t::real(7.5), value_t::integer(2)});
+    vm.call("ratio", {value_t::integer(1), value_t::integer(0)});
+    std::cout << ", ratio(1, 0): " << vm.error() << std::endl;
+
+    // nesting is bounded per context: too deep an input is an error, not a stack overflow
+    const std::string too_deep(100000, '(');
+    std::cout << "too deep: " << diagnose(kpml::expr, too_deep) << std::endl;
+
+    // deeper trees than a parse may build are still copied, rendered and freed without recursing
+    auto chain = kpml::tree_builder_t::number(std::uint64_t{0});
+    for (std::uint64_t i = 1; i <= 100000; i++)
+        chain = kpml::tree_builder_t::binary(0, std::move(chain), kpml::tree_builder_t::number(i));
+    const auto chain_copy = chain;
+    std::ostringstream json;
+    kpml::render(json, chain_copy);
+    std::cout << "deep tree: " << json.str().size() << " bytes of JSON" << std::endl;
+
+    const std::string broken_def = "def f(x, y) {\n  x + (y * 2;\n  x\n}";
+    if (parse_all(kpml::function_def, broken_def).is_empty())
+        std::cout << "error: " << diagnose(kpml::function_def, broken_def) << std::endl;
+    std::cout << "error: " << diagnose(lists(natural), "[1, 2 x]") << std::endl;
+    std::cout << "lexed error: " << diagnose(kpml::lexed::function_def, kpml::lex(broken_def)) << std::endl;
+
+    // past the "if" keyword the statement is committed: it is no longer read as a call to "if"
+    const std::string broken_if = "if (x > 1) { y } els { z }";
+    std::cout << "committed if: " << (parse(kpml::statement, broken_if).is_empty() ? "invalid" : "ok")
+              << ", " << diagnose(kpml::statement, broken_if) << std::endl;
+
     return 0;
 }
 
@@ -100,28 +310,5 @@ void check_statement(const parser_t<kpml::statement_t>& p, const std::string& ex
 
 void show_statement(const kpml::statement_t& s)
 {
-    if (s.is_leaf())
-    {
-        s.show_leaf(std::cout);
-    }
-    else
-    {
-        std::cout << R"({ "op": ")" << s.op << "\",";
-        if (!s.operands.empty())
-        {
-            std::cout << " \"operands\": [";
-            bool f{false};
-            for(const auto& e : s.operands)
-            {
-                if (f)
-                    std::cout << ", ";
-                else
-                    f = true;
-
-                show_statement(e);
-            }
-            std::cout << "]";
-        }
-        std::cout << "}";
-    }
+    kpml::render(std::cout, s);
 }
\ No newline at end of file
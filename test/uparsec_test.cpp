@@ -0,0 +1,1305 @@
+/*
+ * uparsec_test: pass/fail checks of lparser and kpml behaviour that the demo
+ * and the benchmark only show. Exits with the number of failed checks.
+ *
+ * usage: uparsec_test [name filter]
+ * */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+#include "../Include/lparser.hpp"
+#include "../Include/lparser_bricks.hpp"
+#include "../Include/lparser_file.hpp"
+#include "../Include/lparser_memo.hpp"
+#include "../Include/lparser_numeric.hpp"
+#include "../Include/lparser_parallel.hpp"
+#include "../Include/lparser_stream.hpp"
+#include "../Include/lparser_structure.hpp"
+#include "../Include/kpml.hpp"
+#include "../Include/kpml_ast.hpp"
+#include "../Include/kpml_fold.hpp"
+#include "../Include/kpml_lexer.hpp"
+#include "../Include/kpml_session.hpp"
+#include "../Include/kpml_vm.hpp"
+
+
+using namespace lparser;
+
+
+/* harness */
+
+namespace
+{
+    int failures{};
+
+    void check(bool ok, const char* what, const char* file, int line)
+    {
+        if (!ok)
+        {
+            ++failures;
+            std::cerr << file << ":" << line << ": check failed: " << what << std::endl;
+        }
+    }
+
+    std::string json(const kpml::statement_t& s)
+    {
+        std::ostringstream out;
+        kpml::render(out, s);
+        return out.str();
+    }
+
+#ifdef UPARSEC_PROFILE
+    // the counters of a named rule, zero when it never ran
+    profile::rule_stats_t rule_stats(const std::string& name)
+    {
+        for (const auto& s : profile::stats())
+        {
+            if (s.name == name)
+                return s;
+        }
+        return profile::rule_stats_t{name};
+    }
+#endif
+}
+
+#define CHECK(x) check((x), #x, __FILE__, __LINE__)
+
+struct test_t
+{
+    const char* name;
+    void (*run)();
+};
+
+
+/* tests */
+
+// a text refilled at the same address must not be served the entries of the old one
+void memo_same_address()
+{
+    kpml::packrat_t memo;
+    kpml::packrat_scope scope{memo};
+
+    std::string s = "f(1) + 2";
+    const auto first = parse(kpml::expr, s);
+    s = "g(3) * 4";
+    const auto second = parse(kpml::expr, s);
+
+    CHECK(!second.is_empty() && second.remain.empty());
+    CHECK(json(second.get()) == json(parse(kpml::expr, std::string_view{"g(3) * 4"}).get()));
+    CHECK(json(first.get()) != json(second.get()));
+}
+
+// every streamed statement is parsed at the same address: a packrat table left active must still hold
+void stream_with_memo()
+{
+    kpml::packrat_t memo;
+    kpml::packrat_scope scope{memo};
+
+    const std::string piped = "f(1) + 2; g(3) * 4; h(5) - 6; ";
+    std::vector<std::string> got;
+    auto stream = kpml::statement_stream();
+    stream.feed(piped, [&got](const parser_t<kpml::statement_t>& r, std::string_view, std::size_t) {
+        got.push_back(r.is_empty() ? "invalid" : json(r.get()));
+    });
+
+    CHECK(got.size() == 3);
+    for (std::size_t i = 0; i < got.size() && i < 3; ++i)
+    {
+        const std::string text[] = {"f(1) + 2", "g(3) * 4", "h(5) - 6"};
+        CHECK(got[i] == json(parse(kpml::expr, std::string_view{text[i]}).get()));
+    }
+}
+
+// the chains and memo() are combinators like the others: they know where they can start
+void combinator_first_sets()
+{
+    const auto digit = fmap(char_eq('1'), [](char) { return 1L; });
+    const auto minus = fmap(char_eq('-'), [](char) { return [](long a, long b) { return a - b; }; });
+
+    for (const auto& f : {first_of(chainl1(digit, minus)), first_of(chainr1(digit, minus)),
+                          first_of(memo(0, digit))})
+    {
+        CHECK(f.chars.contains('1'));
+        CHECK(!f.chars.contains('-'));
+        CHECK(!f.nullable);
+    }
+
+    CHECK(parse(chainl1(digit, minus), "1-1-1").get() == -1);
+    CHECK(parse(chainr1(digit, minus), "1-1-1").get() == 1);
+}
+
+// a literal out of range is an error where it starts, never a shorter number
+void numbers_out_of_range()
+{
+    const auto real = parse(floating<double>(), "1e400");
+    CHECK(real.is_empty() && real.committed && real.remain.pos == 0);
+
+    const auto whole = parse(integral<std::uint8_t>(), "300");
+    CHECK(whole.is_empty() && whole.committed);
+
+    const auto n = parse(nat, "99999999999999999999");
+    CHECK(n.is_empty() && n.committed);
+
+    for (const auto* text : {"1e400", "x + 1e400", "f(2, 1e400)", "99999999999999999999"})
+    {
+        const auto e = parse(kpml::statement, std::string_view{text});
+        CHECK(e.is_empty() && e.committed);
+    }
+    CHECK(parse(kpml::expr, "1e300").remain.empty());
+
+    const auto tokens = kpml::lex("x + 1e400");
+    CHECK(tokens.size() == 3 && tokens[2].kind == kpml::kind::invalid && tokens[2].length == 5);
+}
+
+// a flat sum parses to a left-deep tree as deep as it is long: simplify must not recurse down it
+void fold_flat_sum()
+{
+    constexpr std::size_t terms = 100000;
+
+    std::string ones = "1";
+    std::string names = "x";
+    for (std::size_t i = 1; i < terms; ++i)
+    {
+        ones += " + 1";
+        names += " + x";
+    }
+
+    auto folded = parse(kpml::expr, ones);
+    CHECK(!folded.is_empty() && folded.remain.empty());
+    auto s = std::move(folded).get();
+    CHECK(kpml::simplify(s) == terms - 1);
+    CHECK(s.leaf_if<std::uint64_t>() && *s.leaf_if<std::uint64_t>() == terms);
+
+    auto kept = parse(kpml::expr, names);
+    CHECK(!kept.is_empty() && kept.remain.empty());
+    auto t = std::move(kept).get();
+    CHECK(kpml::simplify(t) == 0);
+    CHECK(t.op == "+");
+}
+
+// a real that overflows is left as the operation: inf has no literal
+void fold_real_overflow()
+{
+    for (const auto* text : {"1e308 * 10", "1e308 + 1e308", "0 - 1e308 - 1e308", "1e308 / 0.1"})
+    {
+        auto r = parse(kpml::expr, std::string_view{text});
+        CHECK(!r.is_empty() && r.remain.empty());
+        auto s = std::move(r).get();
+        kpml::simplify(s);
+        CHECK(!s.leaf_if<double>());
+        CHECK(json(s).find("inf") == std::string::npos);
+    }
+
+    auto r = parse(kpml::expr, std::string_view{"1e307 * 10"});
+    auto s = std::move(r).get();
+    CHECK(kpml::simplify(s) == 1);
+    CHECK(s.leaf_if<double>() && *s.leaf_if<double>() == 1e308);
+}
+
+// the compiler walks a left-deep body without recursing; a program moves, with its strings in place
+void vm_flat_sum()
+{
+    constexpr std::size_t terms = 100000;
+
+    std::string text = "def sum(x) { x";
+    for (std::size_t i = 1; i < terms; ++i)
+        text += " + x";
+    text += " }\ndef name(x) { \"kpml\" }";
+
+    const auto defs = parse_all(many(token(kpml::function_def)), text);
+    CHECK(!defs.is_empty());
+    if (defs.is_empty())
+        return;
+
+    auto compiled = kpml::vm::compile(defs.get());
+    CHECK(static_cast<bool>(compiled));
+
+    const auto program = std::move(compiled);
+    kpml::vm::machine_t vm{program};
+    const auto sum = vm.call("sum", {kpml::vm::value_t::integer(3)});
+    CHECK(sum && sum->kind == kpml::vm::value_t::kind_t::integer && sum->u == 3 * terms);
+    const auto name = vm.call("name", {kpml::vm::value_t::integer(0)});
+    CHECK(name && name->kind == kpml::vm::value_t::kind_t::string && *name->s == "kpml");
+
+    static_assert(!std::is_copy_constructible_v<kpml::vm::program_t>, "a copy would point into the original's strings");
+}
+// a def tree not of the parser's shape is an error of compile(), not a crash
+void vm_malformed_def()
+{
+    auto good = parse(kpml::function_def, std::string_view{"def f(x) { x }"});
+    CHECK(!good.is_empty());
+    if (good.is_empty())
+        return;
+    const auto def = std::move(good).get();
+    CHECK(static_cast<bool>(kpml::vm::compile({def})));
+
+    auto no_parameters = def;
+    no_parameters.operands[1].op = "begin";
+    const auto a = kpml::vm::compile({no_parameters});
+    CHECK(!a && !a.error.empty());
+
+    auto not_a_symbol = def;
+    not_a_symbol.operands[1].operands[0] = std::string{"x"};
+    const auto b = kpml::vm::compile({not_a_symbol});
+    CHECK(!b && !b.error.empty());
+}
+
+
+// nesting past the depth limit fails where it starts, committed, in every grammar, and unwinds the depth
+void depth_limit()
+{
+    constexpr std::size_t levels = 100000;
+
+    std::string parens(levels, '(');
+    parens += "1";
+    parens.append(levels, ')');
+
+    std::string ifs;
+    for (std::size_t i = 0; i < levels; ++i)
+        ifs += "if (1) { ";
+    ifs += "1";
+    for (std::size_t i = 0; i < levels; ++i)
+        ifs += " } else { 0 }";
+
+    auto& context = parse_context_t::current();
+    for (const auto& text : {parens, ifs})
+    {
+        const auto r = parse(kpml::statement, text);
+        CHECK(r.is_empty() && r.committed);
+        CHECK(context.depth == 0);
+
+        const auto e = diagnose(kpml::statement, text);
+        CHECK(std::find(e.expected.begin(), e.expected.end(), "shallower nesting") != e.expected.end());
+
+        kpml::ast_t ast;
+        kpml::ast_scope in_ast{ast};
+        CHECK(parse(kpml::arena::statement, text).is_empty());
+
+        const auto tokens = kpml::lex(text);
+        const auto t = parse(kpml::lexed::statement, tokens);
+        CHECK(t.is_empty() && t.committed);
+        CHECK(context.depth == 0);
+    }
+
+    // within the limit, and past it in a context that raises it
+    std::string shallow(200, '(');
+    shallow += "1";
+    shallow.append(200, ')');
+    CHECK(parse(kpml::statement, shallow).remain.empty());
+
+    std::string deeper(400, '(');
+    deeper += "1";
+    deeper.append(400, ')');
+    parse_context_t deep;
+    deep.depth_limit = 1024;
+    CHECK(parse(kpml::statement, deeper).is_empty());
+    CHECK(parse(kpml::statement, deeper, deep).remain.empty());
+}
+
+// a rule that throws still leaves the levels it entered
+void depth_after_throw()
+{
+    const auto boom = fmap(char_eq('x'), [](char) -> char { throw std::runtime_error{"boom"}; });
+    auto& context = parse_context_t::current();
+
+    bool thrown{false};
+    try
+    {
+        parse(nested(nested(boom)), "x");
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(context.depth == 0);
+}
+
+// trees far deeper than any parse produces are copied, rendered and destroyed without recursing
+void deep_trees()
+{
+    constexpr std::size_t levels = 200000;
+
+    auto t = kpml::folding::leaf(std::uint64_t{1});
+    for (std::size_t i = 0; i < levels; ++i)
+    {
+        kpml::statement_t n;
+        n.op = "-";
+        n.operands.push_back(std::move(t));
+        t = std::move(n);
+    }
+
+    const auto copy = t;
+    const auto rendered = json(copy);
+    CHECK(rendered == json(t));
+    CHECK(rendered.size() > levels * 10);
+
+    std::string flat = "x";
+    for (std::size_t i = 1; i < levels; ++i)
+        flat += " + x";
+
+    kpml::ast_t ast;
+    kpml::ast_scope in_ast{ast};
+    const auto r = parse(kpml::arena::expr, flat);
+    CHECK(!r.is_empty() && r.remain.empty());
+    if (!r.is_empty())
+    {
+        std::ostringstream out;
+        ast.show(out, r.get());
+        CHECK(out.str().size() > levels * 10);
+    }
+}
+
+
+/* one grammar shared by threads, each parsing in its own context, diagnostics on */
+
+namespace shared
+{
+    struct outcome_t
+    {
+        std::size_t consumed;
+        std::size_t rendered;
+        std::size_t error;
+
+        bool operator==(const outcome_t& o) const { return consumed == o.consumed && rendered == o.rendered && error == o.error; }
+    };
+
+    std::vector<outcome_t> run(const std::vector<std::string>& defs)
+    {
+        std::vector<outcome_t> out;
+        for (const auto& d : defs)
+        {
+            const auto r = parse_all(kpml::function_def, d);
+            out.push_back(r.is_empty()
+                    ? outcome_t{0, 0, diagnose(kpml::function_def, d).offset}
+                    : outcome_t{r.remain.pos, json(r.get()).size(), 0});
+        }
+        return out;
+    }
+
+    // every other def cut short, so half of them fail and get diagnosed
+    std::vector<std::string> defs(std::size_t count)
+    {
+        std::vector<std::string> out;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const auto n = std::to_string(i);
+            std::string d = "def fun_" + n + "(x, y, z) { if ((x + " + n + ") > y) { \"ok" + n + "\" } "
+                            "else { if (y > 0) { g(x, y * 2, z) } else { is_null(x) } } ; x + y * z }";
+            if (i % 2 == 1)
+                d.resize(d.size() / 2);
+            out.push_back(std::move(d));
+        }
+        return out;
+    }
+}
+
+void shared_grammar()
+{
+    constexpr std::size_t threads = 8;
+
+    const auto defs = shared::defs(200);
+    const auto expected = shared::run(defs);
+
+    std::size_t failed{};
+    for (const auto& o : expected)
+        failed += o.rendered == 0 && o.error > 0;
+    CHECK(failed == defs.size() / 2);
+
+    std::atomic<std::size_t> agree{};
+    std::vector<std::thread> pool;
+    for (std::size_t t = 0; t < threads; ++t)
+    {
+        pool.emplace_back([&] {
+            parse_context_t context;
+            context_scope in{context};
+            for (int round = 0; round < 4; ++round)
+            {
+                if (shared::run(defs) != expected)
+                    return;
+            }
+            ++agree;
+        });
+    }
+    for (auto& t : pool)
+        t.join();
+    CHECK(agree == threads);
+}
+
+// names lent by a borrowed source survive the next borrow, under the ids the nodes already hold
+void interner_borrow()
+{
+    kpml::ast_t ast;
+    kpml::ast_scope in_ast{ast};
+
+    std::string first = "alpha + beta";
+    ast.borrow(first);
+    const auto a = parse(kpml::arena::expr, first);
+    CHECK(!a.is_empty());
+    const auto alpha = ast.child(a.get(), 0);
+    CHECK(ast.text(alpha) == "alpha");
+    CHECK(ast.text(alpha).data() == first.data());
+
+    std::string second = "gamma * alpha";
+    ast.borrow(second);
+    first.assign(first.size(), '#');
+    const auto b = parse(kpml::arena::expr, second);
+    CHECK(!b.is_empty());
+
+    ast.borrow({});
+    second.assign(second.size(), '#');
+
+    // the earlier node reads its own name, and an equal name still maps to its atom
+    CHECK(ast.text(alpha) == "alpha");
+    CHECK(ast.text(ast.child(a.get(), 1)) == "beta");
+    CHECK(ast.text(ast.child(b.get(), 0)) == "gamma");
+    CHECK(ast[ast.child(b.get(), 1)].atom == ast[alpha].atom);
+    CHECK(ast.interner().size() == 3);
+}
+
+// a failure met at the depth limit is not replayed where the rule is shallower and succeeds
+void memo_depth_limit()
+{
+    memo_table_t<char> table;
+    const auto x = memo(table, 0, nested(char_eq('x')));
+    const auto deeper = fmap(seq(nested(nested(x)), char_eq('!')), [](auto t) { return std::get<0>(t); });
+    const auto p = pipe(try_(deeper), x);
+
+    parse_context_t context;
+    context.depth_limit = 2;
+    context_scope in{context};
+    memo_scope<char> scope{table};
+
+    const auto r = parse(p, "x");
+    CHECK(!r.is_empty() && r.remain.empty());
+}
+
+// a word operator is a whole word, but a shorter keyword that ends on a boundary still matches
+void keyword_boundary()
+{
+    const auto in = keywords({"in", "int"});
+    CHECK(parse(in, "in x").get() == 0);
+    CHECK(parse(in, "int x").get() == 1);
+    CHECK(parse(in, "intx").is_empty());
+    CHECK(parse(in, "inx").is_empty());
+
+    const auto neg = keywords({"-", "-inf"});
+    const auto r = parse(neg, "-infinity");
+    CHECK(!r.is_empty() && r.get() == 0 && r.remain.pos == 1);
+    CHECK(parse(neg, "-inf").get() == 1);
+}
+
+// statement's alternatives know where they start, so its choice() looks at one of them
+void statement_dispatch()
+{
+    for (const auto& f : {first_of(kpml::grammar::if_else_parser<kpml::tree_builder_t>()),
+                          first_of(kpml::lexed::grammar::if_else_parser<kpml::tree_builder_t>())})
+    {
+        CHECK(!f.chars.contains('x'));
+        CHECK(!f.chars.contains('('));
+    }
+    CHECK(first_of(kpml::grammar::if_else_parser<kpml::tree_builder_t>()).chars.contains('i'));
+    CHECK(first_of(kpml::lexed::grammar::if_else_parser<kpml::tree_builder_t>()).chars.contains(kpml::kind::kw_if));
+
+    for (const auto& f : {first_of(kpml::grammar::factor_parser<kpml::tree_builder_t>()),
+                          first_of(kpml::lexed::grammar::factor_parser<kpml::tree_builder_t>())})
+    {
+        CHECK(f.chars.contains('('));
+        CHECK(!f.chars.contains('$'));
+        CHECK(!f.nullable);
+    }
+
+#ifdef UPARSEC_PROFILE
+    profile::reset();
+    CHECK(!parse(kpml::statement, "x + 1").is_empty());
+    CHECK(rule_stats("if_else").calls == 0);
+    CHECK(!parse(kpml::statement, "iffy + 1").is_empty());
+    CHECK(rule_stats("if_else").calls == 1);
+
+    const auto tokens = kpml::lex("x + 1");
+    CHECK(!parse(kpml::lexed::statement, tokens).is_empty());
+    CHECK(rule_stats("lexed::if_else").calls == 0);
+#endif
+}
+
+// every segment runs in a context of its own, and what p throws reaches the caller
+void parse_segments_isolated()
+{
+    const std::string text = "a,a,a,a,a,a,a,a,b,a,a,a,a,a,a,a";
+    std::vector<segment_t> segments;
+    for (std::size_t i = 0; i < text.size(); i += 2)
+        segments.push_back(segment_t{i, i + 1});
+
+    parse_context_t caller;
+    context_scope in{caller};
+    failure_t f;
+    failure_scope failures{f};
+
+    const auto fresh = fmap(item, [&caller](char c) {
+        const auto& context = parse_context_t::current();
+        return &context != &caller && context.failure == nullptr ? c : '?';
+    });
+
+    work_pool_t pool{4};
+    const auto rs = parse_segments(fresh, text, segments, pool);
+    CHECK(rs.size() == segments.size());
+    CHECK(std::all_of(rs.begin(), rs.end(), [](const auto& r) { return !r.is_empty() && r.get() != '?'; }));
+
+    const auto boom = fmap(item, [](char c) -> char {
+        if (c == 'b')
+            throw std::runtime_error{"boom"};
+        return c;
+    });
+
+    bool thrown = false;
+    try
+    {
+        parse_segments(boom, text, segments, pool);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(parse_segments(fresh, text, segments, pool).size() == segments.size());
+}
+
+
+// results are views into the text and cursors over it: no parser copies the input
+void input_cursor()
+{
+    const std::string text = "abc def";
+
+    const auto r = parse(ident, text);
+    CHECK(!r.is_empty() && r.get() == "abc");
+    CHECK(r.get().data() == text.data());
+    CHECK(r.remain.buffer.data() == text.data() && r.remain.pos == 3);
+    CHECK(r.remain.rest() == " def");
+
+    const auto w = parse(seq(space, ident), r.remain);
+    CHECK(!w.is_empty() && w.remain.empty());
+    CHECK(std::get<1>(w.get()).data() == text.data() + 4);
+
+    const auto c = parse(consumed(seq(ident, space, ident)), text);
+    CHECK(!c.is_empty() && c.get().data() == text.data() && c.get().size() == text.size());
+
+    const std::string copy = text;
+    CHECK(input_t(text, 4) == input_t(text, 4));
+    CHECK(input_t(text, 4) != input_t(copy, 4));
+    CHECK(input_t(text, 4).upto(input_t(text, 7)) == "def");
+}
+
+// results are held inline and only moved, so a move-only value goes through the combinators
+void move_only_results()
+{
+    static_assert(!std::is_copy_constructible_v<parser_t<int>>, "a result is moved, never copied");
+    static_assert(std::is_nothrow_move_constructible_v<parser_t<std::string>>, "a result moves like its value");
+
+    const auto boxed = fmap(digit, [](char c) { return std::make_unique<int>(c - '0'); });
+    const auto r = parse(seq(boxed, char_eq('+'), boxed), "1+2");
+    CHECK(!r.is_empty() && r.remain.empty());
+    CHECK(*std::get<0>(r.get()) + *std::get<2>(r.get()) == 3);
+
+    auto xs = parse(many(boxed), "123x");
+    CHECK(!xs.is_empty() && xs.get().size() == 3 && *xs.get()[2] == 3 && xs.remain.pos == 3);
+    auto moved = std::move(xs).get();
+    CHECK(moved.size() == 3);
+
+    const auto f = parse(seq(char_eq('a'), cut, boxed), "ab");
+    CHECK(f.is_empty() && f.committed && f.remain.pos == 1);
+}
+
+// the precedence table: higher levels bind tighter, and each level associates its own way
+void operator_precedence()
+{
+    const auto number = fmap(digit, [](char c) { return static_cast<long>(c - '0'); });
+    const std::vector<operator_def_t> ops{
+            {"-", 1, assoc_t::left}, {"*", 2, assoc_t::left}, {"^", 3, assoc_t::right}
+    };
+    const auto arith = expression(number, ops, [](std::string_view op, long a, long b) {
+        if (op == "-")
+            return a - b;
+        if (op == "*")
+            return a * b;
+        long r = 1;
+        while (b-- > 0)
+            r *= a;
+        return r;
+    });
+
+    CHECK(parse(arith, "9-3-2").get() == 4);
+    CHECK(parse(arith, "2^3^2").get() == 512);
+    CHECK(parse(arith, "1-2*3^2").get() == -17);
+
+    const auto r = parse(arith, "8-");
+    CHECK(!r.is_empty() && r.get() == 8 && r.remain.pos == 1);
+
+    const auto tree = parse(kpml::expr, std::string_view{"a + b * c - d"});
+    CHECK(!tree.is_empty() && tree.remain.empty());
+    CHECK(json(tree.get()) == json(parse(kpml::expr, std::string_view{"(a + (b * c)) - d"}).get()));
+    CHECK(json(tree.get()) != json(parse(kpml::expr, std::string_view{"a + (b * c - d)"}).get()));
+}
+
+// a grammar is one plain value: seq flattens, nothing is erased unless asked for with parser_fun_t
+void static_combinators()
+{
+    const auto p = seq(char_eq('a'), many(digit), pipe(char_eq('b'), char_eq('c')), string_eq("end"));
+    static_assert(std::tuple_size_v<value_of_t<decltype(p)>> == 4, "seq keeps one flat tuple");
+
+    const auto r = parse(p, "a12cend");
+    CHECK(!r.is_empty() && r.remain.empty());
+    CHECK(std::get<1>(r.get()).size() == 2 && std::get<2>(r.get()) == 'c');
+
+    const parser_fun_t<value_of_t<decltype(p)>> erased = p;
+    const auto e = parse(erased, "a12cend");
+    CHECK(!e.is_empty() && e.get() == r.get());
+    CHECK(parse(erased, "a12dend").is_empty());
+}
+
+// every span scanner path counts what the bitmap counts, wherever the first miss falls
+void span_scanners()
+{
+    const char_class_t many_ranges = char_class_t::of("acegikmo");
+    const char_class_t high = classes::lower | char_class_t::range('\x80', '\xff');
+    const char_class_t sets[] = {classes::digit, classes::space, classes::ident_tail, many_ranges, high};
+
+    CHECK(classes::xdigit.contains('F') && !classes::xdigit.contains('g'));
+    CHECK((~classes::digit).contains('a') && !(classes::digit & classes::lower).contains('5'));
+
+    std::uint32_t seed = 7;
+    const auto next = [&seed] { return seed = seed * 1103515245u + 12345u, seed >> 16; };
+
+    for (const auto& c : sets)
+    {
+        std::string members, others;
+        for (unsigned u = 1; u < 256; ++u)
+            (c.contains(static_cast<char>(u)) ? members : others) += static_cast<char>(u);
+
+        const char_scanner_t scanner{c};
+        for (std::size_t length = 0; length < 80; ++length)
+        {
+            for (std::size_t miss = 0; miss <= length; ++miss)
+            {
+                std::string s;
+                for (std::size_t i = 0; i < length; ++i)
+                    s += i == miss ? others[next() % others.size()] : members[next() % members.size()];
+
+                std::size_t expected = 0;
+                while (expected < s.size() && c.contains(s[expected]))
+                    ++expected;
+                CHECK(scanner.span(s) == expected);
+            }
+        }
+    }
+}
+
+// radix prefixes, digit separators and the bounds of each type, as kpml's number format reads them
+void numeric_literals()
+{
+    const auto u64 = integral<std::uint64_t>(kpml::number_format);
+    const auto real = floating<double>(kpml::number_format);
+
+    CHECK(parse(u64, "0x1F").get() == 31);
+    CHECK(parse(u64, "0o17").get() == 15);
+    CHECK(parse(u64, "0b101").get() == 5);
+    CHECK(parse(u64, "1_000").get() == 1000);
+    CHECK(parse(u64, "18446744073709551615").get() == 18446744073709551615u);
+
+    // a separator or a prefix with no digit after it is not part of the literal
+    for (const auto* text : {"1__0", "1_", "0x", "0b2"})
+    {
+        const auto r = parse(u64, text);
+        CHECK(!r.is_empty() && r.remain.pos == 1);
+    }
+
+    CHECK(parse(real, "1_0.2_5").get() == 10.25);
+    CHECK(parse(real, "1e3").get() == 1000.0);
+    for (const auto* text : {"1", ".5", "1.", "-1.5"})
+    {
+        const auto r = parse(real, text);
+        CHECK(r.is_empty() && !r.committed);
+    }
+
+    const auto i64 = integral<std::int64_t>();
+    CHECK(parse(i64, "-9223372036854775808").get() == std::numeric_limits<std::int64_t>::min());
+    CHECK(parse(i64, "-9223372036854775809").committed);
+    CHECK(parse(i64, "-").is_empty());
+    CHECK(parse(floating<double>(), "-2.5e-3").get() == -2.5e-3);
+}
+
+// the arena grammar builds the trees the statement_t grammar builds, with each name interned once
+void arena_ast()
+{
+    static_assert(sizeof(kpml::ast_t::node_t) <= 16, "a node is an opcode and one 8 byte payload");
+
+    kpml::ast_t ast;
+    kpml::ast_scope in_ast{ast};
+
+    for (const auto* text : {"f(x, 2) * 3.5 + \"s\"", "if (x > 1) { f(x) } else { y }", "x in y"})
+    {
+        const auto a = parse(kpml::arena::statement, std::string_view{text});
+        const auto s = parse(kpml::statement, std::string_view{text});
+        CHECK(!a.is_empty() && !s.is_empty());
+
+        std::ostringstream shown;
+        ast.show(shown, a.get());
+        CHECK(shown.str() == json(s.get()));
+    }
+    CHECK(ast.interner().size() == 4);
+
+    const auto nodes = ast.size();
+    ast.clear();
+    CHECK(ast.size() == 0 && nodes > 0);
+    CHECK(ast.interner().size() == 4);
+    const auto d = parse(kpml::arena::function_def, std::string_view{"def f(x, y) { x + y; x }"});
+    CHECK(!d.is_empty() && d.remain.empty());
+    CHECK(ast.text(ast.child(d.get(), 0)) == "f");
+}
+
+// named rules are counted when profiling is compiled in, and are their parser otherwise
+void profile_counters()
+{
+    const auto ab = named("test::ab", seq(char_eq('a'), char_eq('b')));
+
+#ifdef UPARSEC_PROFILE
+    profile::reset();
+    CHECK(!parse(ab, "ab").is_empty());
+    CHECK(parse(ab, "ax").is_empty());
+
+    auto s = rule_stats("test::ab");
+    CHECK(s.calls == 2 && s.successes == 1 && s.failures == 1);
+    CHECK(s.consumed == 2 && s.backtracked == 1);
+
+    // rules of the same name share their counters
+    CHECK(!parse(named("test::ab", char_eq('z')), "z").is_empty());
+    CHECK(rule_stats("test::ab").calls == 3);
+
+    std::ostringstream out;
+    profile::report_json(out);
+    CHECK(out.str().find(R"("rule": "test::ab", "calls": 3)") != std::string::npos);
+
+    profile::reset();
+    CHECK(rule_stats("test::ab").calls == 0);
+#else
+    static_assert(std::is_same_v<decltype(ab), const decltype(seq(char_eq('a'), char_eq('b')))>,
+                  "without UPARSEC_PROFILE a named rule is its parser");
+    CHECK(!parse(ab, "ab").is_empty());
+    CHECK(profile::stats().empty());
+#endif
+}
+
+// the error is where the parse got farthest, with its line, column and everything expected there
+void farthest_failure()
+{
+    const auto e = diagnose(kpml::function_def, std::string_view{"def f(x) {\n  x + (1\n}"});
+    CHECK(e.offset == 20 && e.position.line == 3 && e.position.column == 1);
+    CHECK(e.found == "}");
+    CHECK(e.expected == (std::vector<std::string>{"operator", "')'"}));
+    CHECK(e.message() == "3:1: unexpected '}', expected operator or ')'");
+
+    const auto alternatives = diagnose(seq(char_eq('a'), pipe(char_eq('b'), char_eq('c'))), "ad");
+    CHECK(alternatives.message() == "1:2: unexpected 'd', expected 'b' or 'c'");
+
+    const auto end = diagnose(seq(char_eq('a'), char_eq('b')), "a");
+    CHECK(end.offset == 1 && end.found.empty());
+    CHECK(end.message() == "1:2: unexpected end of input, expected 'b'");
+
+    // a plain parse records nothing
+    CHECK(!diagnosing());
+    CHECK(parse(char_eq('b'), "a").is_empty() && !diagnosing());
+}
+
+// a failure past a cut is final for the enclosing pipe; try_() confines the cut again
+void committed_choice()
+{
+    const auto let = seq(string_eq("let"), cut, char_eq(' '), ident);
+    const auto other = fmap(string_eq("letter"), [](std::string_view s) { return std::make_tuple(s, ' ', s); });
+
+    const auto before = parse(pipe(seq(string_eq("let"), char_eq(' '), ident), other), "letter");
+    CHECK(!before.is_empty());
+
+    const auto after = parse(pipe(let, other), "letter");
+    CHECK(after.is_empty() && after.committed && after.remain.pos == 3);
+
+    const auto confined = parse(pipe(try_(let), other), "letter");
+    CHECK(!confined.is_empty() && confined.remain.empty());
+
+    // a failure before the cut still lets the pipe go on
+    CHECK(!parse(pipe(let, other), "lex").committed);
+
+    // committed failures cross every enclosing combinator that does not confine them
+    CHECK(parse(many(seq(pipe(let, other), char_eq(';'))), "let x;letter;").committed);
+    CHECK(parse(kpml::statement, "if (x) { 1 }").committed);
+}
+
+// choice() gives what pipe() gives, trying only the alternatives that can start at the next byte
+void choice_dispatch()
+{
+    int tried = 0;
+    const auto counted = [&tried](input_t inp) {
+        ++tried;
+        return parse(char_eq('x'), inp);
+    };
+    const auto number = sat(classes::digit, "digit");
+    const auto c = choice(starts_with(char_class_t::of("x"), counted), number, char_eq('-'));
+    const auto p = pipe(starts_with(char_class_t::of("x"), counted), number, char_eq('-'));
+
+    for (const auto* text : {"x", "5", "-", "a", ""})
+    {
+        const auto a = parse(c, text), b = parse(p, text);
+        CHECK(a.is_empty() == b.is_empty() && a.remain.pos == b.remain.pos);
+        CHECK(a.is_empty() || a.get() == b.get());
+    }
+
+    tried = 0;
+    CHECK(parse(c, "5").get() == '5' && parse(c, "a").is_empty());
+    CHECK(tried == 0);
+    CHECK(parse(c, "x").get() == 'x' && tried == 1);
+
+    const auto f = first_of(c);
+    CHECK(f.chars.contains('x') && f.chars.contains('7') && f.chars.contains('-') && !f.chars.contains('a'));
+    CHECK(!f.nullable);
+
+    // a nullable alternative is tried on any byte, and at the end of input
+    const auto fallback = choice(char_eq('a'), pure('?'));
+    CHECK(parse(fallback, "b").get() == '?' && parse(fallback, "").get() == '?');
+
+    const auto ops = one_of({"<", "<=", "<<="});
+    CHECK(parse(ops, "<<=x").get() == "<<=");
+    CHECK(parse(ops, "<x").get() == "<");
+    CHECK(parse(ops, "x").is_empty());
+}
+
+// literals match at the cursor only; keyword() and keywords() only as whole words
+void literal_matching()
+{
+    const std::string text = "iffy if";
+    const auto s = parse(string_eq("if"), text);
+    CHECK(!s.is_empty() && s.get().data() == text.data() && s.remain.pos == 2);
+    CHECK(parse(string_eq("fy"), text).is_empty());
+    CHECK(parse(string_eq("iffy if!"), text).is_empty());
+    CHECK(parse(string_eq(""), text).remain.pos == 0);
+
+    CHECK(parse(keyword("if"), text).is_empty());
+    CHECK(parse(keyword("if"), "if(x)").remain.pos == 2);
+    CHECK(parse(keyword("=="), "==x").remain.pos == 2);
+
+    const auto sym = parse(symbol("if"), "  if  x");
+    CHECK(!sym.is_empty() && sym.get() == "if" && sym.remain.pos == 6);
+
+    const auto words = keywords({"if", "else", "elsif"});
+    CHECK(parse(words, "elsif x").get() == 2);
+    CHECK(parse(words, "else{").get() == 1);
+    CHECK(parse(words, "elsewhere").is_empty());
+}
+
+// the repetitions fold into what the caller supplies, and leave a dangling separator in the input
+void fold_repetition()
+{
+    const auto n = fmap(sat(classes::digit, "digit"), [](char c) { return c - '0'; });
+    const auto comma = char_eq(',');
+
+    CHECK(parse(many_fold(n, 0, [](int& acc, int x) { acc += x; }), "1234x").get() == 10);
+    CHECK(parse(skip_many(char_eq(' ')), "   x").get() == 3);
+
+    char buffer[4]{};
+    const auto written = parse(many_to(sat(classes::lower, "letter"), buffer), "abc1");
+    CHECK(!written.is_empty() && written.get() == buffer + 3 && std::string_view(buffer, 3) == "abc");
+
+    const auto xs = parse(sep_by(n, comma, 8), "1,2,3,");
+    CHECK(xs.get() == (std::vector<int>{1, 2, 3}) && xs.remain.pos == 5);
+    CHECK(parse(sep_end_by(n, comma), "1,2,3,").remain.pos == 6);
+    CHECK(parse(sep_by(n, comma), "x").get().empty());
+    CHECK(parse(sep_by1(n, comma), "x").is_empty());
+    CHECK(parse(sep_by_fold(n, comma, 1, [](int& acc, int x) { acc *= x; }), "2,3,4").get() == 24);
+
+    CHECK(parse(count(2, n), "123").get() == (std::vector<int>{1, 2}));
+    CHECK(parse(count(4, n), "123").is_empty());
+}
+
+// the lexer's tokens, and the token grammar building the trees the text grammar builds
+void token_grammar()
+{
+    const auto tokens = kpml::lex("if x >= 0x10 { \"s\" } else { x in 2.5 } $");
+    const std::string kinds{kpml::kind::kw_if, kpml::kind::identifier, kpml::kind::op_ge, kpml::kind::integer,
+                            '{', kpml::kind::string, '}', kpml::kind::kw_else, '{', kpml::kind::identifier,
+                            kpml::kind::op_in, kpml::kind::real, '}', kpml::kind::invalid};
+    CHECK(tokens.kinds() == kinds);
+    CHECK(tokens.spelling(3) == "0x10" && std::get<std::uint64_t>(tokens.literal(tokens[3].id)) == 16);
+    CHECK(std::get<double>(tokens.literal(tokens[11].id)) == 2.5);
+    CHECK(tokens[1].id == tokens[9].id && tokens.name(tokens[1].id) == "x");
+    CHECK(tokens.name(tokens[5].id) == "s");
+
+    for (const auto* text : {"f(x, 2) * 3.5 + \"s\"", "if (x > 1) { f(x) } else { y in z }", "a - b - c"})
+    {
+        const auto lexed = kpml::lex(text);
+        const auto a = parse_all(kpml::lexed::statement, lexed);
+        const auto b = parse_all(kpml::statement, std::string_view{text});
+        CHECK(!a.is_empty() && !b.is_empty());
+        CHECK(json(a.get()) == json(b.get()));
+    }
+
+    const std::string def = "def f(x, y) { x + y; x }";
+    const auto lexed = kpml::lex(def);
+    const auto d = parse_all(kpml::lexed::function_def, lexed);
+    CHECK(!d.is_empty() && json(d.get()) == json(parse_all(kpml::function_def, def).get()));
+
+    const auto bad = kpml::lex("def f(x) {\n  x +\n}");
+    const auto e = diagnose(kpml::lexed::function_def, bad);
+    CHECK(e.position.line == 3 && e.position.column == 1 && e.found == "}");
+}
+
+// a file is parsed where it is mapped, and the views of the result stay valid with the file it came with
+void file_input()
+{
+    char path[] = "/tmp/uparsec_test_XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    close(fd);
+
+    std::ofstream{path} << "def f(x) { x + 1 }\ndef g(y) { f(y) }\n";
+    auto r = parse_file(path, many(token(kpml::function_def)));
+    CHECK(r.file.is_mapped() && !r.result.is_empty() && r.result.remain.empty());
+    CHECK(r.result.get().size() == 2);
+    CHECK(r.result.remain.buffer.data() == r.file.text().data());
+
+    const auto moved = std::move(r);
+    CHECK(moved.result.remain.buffer.data() == moved.file.text().data());
+    CHECK(json(moved.result.get()[1]) == json(parse(kpml::function_def, std::string_view{"def g(y) { f(y) }"}).get()));
+
+    std::ofstream{path, std::ios::trunc};
+    const auto empty_file = parse_file(path, many(token(kpml::function_def)));
+    CHECK(empty_file.file && !empty_file.result.is_empty() && empty_file.result.get().empty());
+
+    std::remove(path);
+    const auto missing = parse_file(path, many(token(kpml::function_def)));
+    CHECK(!missing.file && missing.file.error() == std::errc::no_such_file_or_directory);
+    CHECK(missing.result.is_empty());
+}
+
+// statements end outside brackets and quotes, and chunks of any size give the statements of the whole text
+void push_stream()
+{
+    const std::string raw = "a(b; c); \"d;e\"; {f; [g]};  ;\nh";
+    std::vector<std::string> pieces;
+    for (const auto& s : split(raw))
+        pieces.emplace_back(raw.substr(s.first, s.last - s.first));
+    CHECK(pieces == (std::vector<std::string>{"a(b; c)", " \"d;e\"", " {f; [g]}", "\nh"}));
+
+    const std::string text = "x + 1; f(2, (3 * y)); if (x) { y } else { 1 + };\n\"s\"";
+    std::vector<std::string> whole;
+    for (const auto& s : split(text))
+    {
+        const auto r = parse_all(kpml::statement, text.substr(s.first, s.last - s.first));
+        whole.push_back(std::to_string(s.first) + ":" + (r.is_empty() ? "failed" : json(r.get())));
+    }
+    CHECK(whole.size() == 4);
+
+    for (std::size_t size = 1; size <= text.size(); ++size)
+    {
+        std::vector<std::string> streamed;
+        const auto sink = [&streamed](const parser_t<kpml::statement_t>& r, std::string_view, std::size_t offset) {
+            streamed.push_back(std::to_string(offset) + ":" + (r.is_empty() ? "failed" : json(r.get())));
+        };
+
+        auto stream = push_parser(kpml::statement);
+        std::size_t n{}, held{};
+        for (std::size_t at = 0; at < text.size(); at += size)
+        {
+            n += stream.feed(std::string_view{text}.substr(at, size), sink);
+            held = std::max(held, stream.buffered());
+        }
+        n += stream.finish(sink);
+
+        CHECK(n == whole.size() && streamed == whole);
+        CHECK(stream.released() == text.size() && held < text.size());
+    }
+}
+
+// every index runs once on some thread, and parallel defs come back as a sequential parse gives them
+void parallel_definitions()
+{
+    work_pool_t pool{4};
+
+    std::vector<std::atomic<int>> runs(1000);
+    pool.for_each(runs.size(), [&runs](std::size_t i) {
+        // uneven items: the threads with the cheap ones steal from the others
+        volatile std::size_t spin = i % 10 == 0 ? 20000 : 0;
+        while (spin > 0)
+            spin = spin - 1;
+        ++runs[i];
+    });
+    CHECK(std::all_of(runs.begin(), runs.end(), [](const auto& n) { return n == 1; }));
+
+    std::string text;
+    for (int i = 0; i < 200; ++i)
+        text += "def f" + std::string(1, static_cast<char>('a' + i % 26)) + "(x) { if (x) { x + " + std::to_string(i) + " } else { \"s\" } }\n";
+    const auto sequential = parse(many(token(kpml::function_def)), text);
+    CHECK(!sequential.is_empty() && sequential.get().size() == 200);
+    text += "def broken(x) { x + }";
+
+    for (std::size_t threads : {1, 4})
+    {
+        work_pool_t p{threads};
+        const auto defs = kpml::parse_definitions(text, p);
+        CHECK(defs.size() == 201);
+        if (defs.size() != 201)
+            continue;
+
+        for (std::size_t i = 0; i < 200; ++i)
+            CHECK(!defs[i].is_empty() && json(defs[i].get()) == json(sequential.get()[i]));
+        CHECK(defs[200].is_empty());
+    }
+}
+
+// the index holds what a byte by byte scan finds, on the AVX2 path as on the scalar one
+void structural_index()
+{
+    const delimiters_t d{};
+    const auto structural = d.open | d.close | char_class_t::of(",;");
+
+    std::uint32_t seed = 11;
+    const auto next = [&seed] { return seed = seed * 1103515245u + 12345u, seed >> 16; };
+    const std::string alphabet = "(){}[],;\" ab\n";
+
+    for (std::size_t length : {0, 1, 63, 64, 65, 127, 128, 200, 1000})
+    {
+        for (int round = 0; round < 20; ++round)
+        {
+            std::string text;
+            for (std::size_t i = 0; i < length; ++i)
+                text += alphabet[next() % alphabet.size()];
+
+            std::vector<std::size_t> expected;
+            bool quoted = false;
+            for (std::size_t i = 0; i < text.size(); ++i)
+            {
+                if (text[i] == d.quote)
+                    quoted = !quoted;
+                if (text[i] == d.quote || (!quoted && structural.contains(text[i])))
+                    expected.push_back(i);
+            }
+
+            // a class with a byte past ASCII takes the scalar path on any CPU
+            const structural_index_t index{text, d};
+            const structural_index_t scalar{text, d, char_class_t::of(",\xe9")};
+            CHECK(index.vectorized() == detail::cpu_has_avx2() && !scalar.vectorized());
+            for (const auto* i : {&index, &scalar})
+            {
+                std::vector<std::size_t> offsets;
+                for (std::size_t k = 0; k < i->size(); ++k)
+                    offsets.push_back(i->offset(k));
+                CHECK(offsets == expected);
+            }
+
+            const auto a = split(index), b = split(text, d);
+            CHECK(a.size() == b.size());
+            for (std::size_t i = 0; i < std::min(a.size(), b.size()); ++i)
+                CHECK(a[i].first == b[i].first && a[i].last == b[i].last);
+        }
+    }
+
+#ifdef UPARSEC_AVX2_DISPATCH
+    if (detail::cpu_has_avx2())
+    {
+        std::uint8_t lo[16]{}, hi[16]{};
+        for (unsigned u = 0; u < 128; ++u)
+        {
+            if (structural.contains(static_cast<char>(u)))
+                lo[u & 0x0F] |= static_cast<std::uint8_t>(1u << (u >> 4));
+        }
+        for (unsigned h = 0; h < 8; ++h)
+            hi[h] = static_cast<std::uint8_t>(1u << h);
+
+        for (int round = 0; round < 200; ++round)
+        {
+            char block[64];
+            for (auto& c : block)
+                c = static_cast<char>(next() % 256);
+            const auto v = detail::classify_avx2(block, lo, hi, '"');
+            const auto s = detail::classify_scalar(block, structural, '"');
+            CHECK(v.members == s.members && v.quotes == s.quotes);
+        }
+    }
+#endif
+
+    const std::string nested = "f(a, [b]) ; g{\"(\"}";
+    const structural_index_t index{nested, d};
+    CHECK(index.closing(1) == 8 && index.closing(13) == 17);
+    CHECK(index.closing(2) == structural_index_t::none);
+}
+
+// a batch reports each input's status and bytes consumed, and its tree, on one thread as on several
+void batch_session()
+{
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 50; ++i)
+    {
+        inputs.push_back("f(x, " + std::to_string(i) + ") * 2");
+        inputs.push_back("y )");
+        inputs.push_back("$");
+    }
+
+    for (std::size_t threads : {1, 3})
+    {
+        kpml::parser_session_t session{threads};
+        for (int batch = 0; batch < 2; ++batch)
+        {
+            const auto& r = session.parse(inputs);
+            CHECK(r.size() == inputs.size());
+            for (std::size_t i = 0; i < inputs.size(); i += 3)
+            {
+                CHECK(r.status[i] == kpml::parse_status_t::ok && r.consumed[i] == inputs[i].size());
+                std::ostringstream shown;
+                session.ast(i).show(shown, r.root[i]);
+                CHECK(shown.str() == json(parse(kpml::statement, inputs[i]).get()));
+
+                CHECK(r.status[i + 1] == kpml::parse_status_t::partial && r.consumed[i + 1] == 2);
+                CHECK(r.status[i + 2] == kpml::parse_status_t::invalid && r.consumed[i + 2] == 0);
+            }
+        }
+
+        const std::string_view few[] = {"a", "b + "};
+        const auto& r = session.parse(few);
+        CHECK(r.size() == 2 && r.status[0] == kpml::parse_status_t::ok);
+        CHECK(r.status[1] == kpml::parse_status_t::partial && r.consumed[1] == 2);
+    }
+}
+
+// each thread has its own default context; scopes and parse(p, text, context) put back what they replaced
+void context_isolation()
+{
+    auto& mine = parse_context_t::current();
+    const parse_context_t* theirs = nullptr;
+    std::thread{[&theirs] { theirs = &parse_context_t::current(); }}.join();
+    CHECK(theirs != &mine);
+
+    parse_context_t outer, inner;
+    {
+        context_scope a{outer};
+        CHECK(&parse_context_t::current() == &outer);
+        {
+            context_scope b{inner};
+            CHECK(&parse_context_t::current() == &inner);
+        }
+        CHECK(&parse_context_t::current() == &outer);
+
+        const parse_context_t* during = nullptr;
+        const auto probe = fmap(item, [&during](char c) {
+            during = &parse_context_t::current();
+            return c;
+        });
+        CHECK(!parse(probe, std::string_view{"x"}, inner).is_empty() && during == &inner);
+        CHECK(&parse_context_t::current() == &outer);
+        CHECK(inner.generation == 1);
+    }
+    CHECK(&parse_context_t::current() == &mine);
+
+    // the typed slots hold one pointer per type, and set() hands back the previous one
+    int i{};
+    double d{};
+    CHECK(outer.set(&i) == nullptr && outer.set(&d) == nullptr);
+    CHECK(outer.get<int>() == &i && outer.get<double>() == &d);
+    CHECK(outer.set<int>(nullptr) == &i && outer.get<int>() == nullptr && outer.get<double>() == &d);
+}
+
+// alternatives that re-read a memoized rule at the same offset run it once
+void memo_replay()
+{
+    int runs = 0;
+    const auto word = [&runs](input_t inp) {
+        ++runs;
+        return parse(ident, inp);
+    };
+
+    memo_table_t<std::string_view> table;
+    const auto w = memo(table, 0, word);
+    const auto p = pipe(seq(w, char_eq('!')), seq(w, char_eq('?')), seq(w, char_eq('.')));
+
+    const auto r = parse(p, "hello.");
+    CHECK(!r.is_empty() && std::get<0>(r.get()) == "hello" && r.remain.empty());
+    CHECK(runs == 1 && table.hit_count() == 2);
+
+    // a failure is replayed too, and a new parse starts from an empty table
+    runs = 0;
+    CHECK(parse(p, "123").is_empty());
+    CHECK(runs == 1);
+
+    runs = 0;
+    const auto plain = pipe(seq(word, char_eq('!')), seq(word, char_eq('?')), seq(word, char_eq('.')));
+    CHECK(!parse(plain, "hello.").is_empty() && runs == 3);
+}
+
+
+int main(int argc, char** argv)
+{
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    const std::vector<test_t> tests{
+            {"memo_same_address", memo_same_address},
+            {"stream_with_memo", stream_with_memo},
+            {"combinator_first_sets", combinator_first_sets},
+            {"numbers_out_of_range", numbers_out_of_range},
+            {"fold_flat_sum", fold_flat_sum},
+            {"fold_real_overflow", fold_real_overflow},
+            {"vm_flat_sum", vm_flat_sum},
+            {"vm_malformed_def", vm_malformed_def},
+            {"depth_limit", depth_limit},
+            {"depth_after_throw", depth_after_throw},
+            {"deep_trees", deep_trees},
+            {"shared_grammar", shared_grammar},
+            {"interner_borrow", interner_borrow},
+            {"memo_depth_limit", memo_depth_limit},
+            {"keyword_boundary", keyword_boundary},
+            {"statement_dispatch", statement_dispatch},
+            {"parse_segments_isolated", parse_segments_isolated},
+            {"input_cursor", input_cursor},
+            {"move_only_results", move_only_results},
+            {"operator_precedence", operator_precedence},
+            {"static_combinators", static_combinators},
+            {"span_scanners", span_scanners},
+            {"numeric_literals", numeric_literals},
+            {"arena_ast", arena_ast},
+            {"profile_counters", profile_counters},
+            {"farthest_failure", farthest_failure},
+            {"committed_choice", committed_choice},
+            {"choice_dispatch", choice_dispatch},
+            {"literal_matching", literal_matching},
+            {"fold_repetition", fold_repetition},
+            {"token_grammar", token_grammar},
+            {"file_input", file_input},
+            {"push_stream", push_stream},
+            {"parallel_definitions", parallel_definitions},
+            {"structural_index", structural_index},
+            {"batch_session", batch_session},
+            {"context_isolation", context_isolation},
+            {"memo_replay", memo_replay},
+    };
+
+    for (const auto& t : tests)
+    {
+        if (std::string{t.name}.find(filter) == std::string::npos)
+            continue;
+
+        const auto before = failures;
+        t.run();
+        std::cout << (failures == before ? "ok     " : "FAILED ") << t.name << std::endl;
+    }
+    return failures;
+}